@@ -18,31 +18,142 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <X11/Xatom.h>
 #include "windowlab.h"
 
-Client *find_client(Window w, int mode)
+/* Clients are indexed by both their window and their frame in a
+ * single open addressing hash table (linear probing, kept at most
+ * half full), so that looking one up doesn't mean walking the whole
+ * client list on every event. XIDs are unique, so a window can never
+ * collide with another client's frame; we just have to check which
+ * of the two we matched. */
+
+typedef struct ClientSlot
+{
+	Window id;
+	Client *c;
+} ClientSlot;
+
+static ClientSlot *client_index = NULL;
+static unsigned int index_size = 0, index_used = 0;
+
+static unsigned int hash_xid(Window w)
 {
-	Client *c = head_client;
-	if (mode == FRAME)
+	return (unsigned int)((w * 2654435761UL) ^ (w >> 16)) & (index_size - 1);
+}
+
+static void index_insert(Window id, Client *c)
+{
+	unsigned int i = hash_xid(id);
+	while (client_index[i].id != None)
 	{
-		while (c != NULL)
+		i = (i + 1) & (index_size - 1);
+	}
+	client_index[i].id = id;
+	client_index[i].c = c;
+	index_used++;
+}
+
+/* Backward shift deletion, so that we never need tombstones: after
+ * emptying a slot, pull forward any later entry in the same probe
+ * run that would otherwise no longer be reachable. */
+
+static void index_delete(Window id)
+{
+	unsigned int i, j, home;
+
+	if (client_index == NULL)
+	{
+		return;
+	}
+	for (i = hash_xid(id); client_index[i].id != id; i = (i + 1) & (index_size - 1))
+	{
+		if (client_index[i].id == None)
 		{
-			if (c->frame == w)
-			{
-				return c;
-			}
-			c = c->next;
+			return;
 		}
 	}
-	else // WINDOW
+	client_index[i].id = None;
+	client_index[i].c = NULL;
+	index_used--;
+
+	for (j = (i + 1) & (index_size - 1); client_index[j].id != None; j = (j + 1) & (index_size - 1))
+	{
+		home = hash_xid(client_index[j].id);
+		// move j back to i unless its home lies cyclically within (i, j]
+		if ((i <= j) ? (home <= i || home > j) : (home <= i && home > j))
+		{
+			client_index[i] = client_index[j];
+			client_index[j].id = None;
+			client_index[j].c = NULL;
+			i = j;
+		}
+	}
+}
+
+static void index_grow(void)
+{
+	ClientSlot *old_index = client_index;
+	unsigned int old_size = index_size, i;
+
+	index_size = (old_size == 0) ? 64 : old_size * 2;
+	client_index = (ClientSlot *)calloc(index_size, sizeof(ClientSlot));
+	if (client_index == NULL)
+	{
+		err("unable to allocate client index");
+		exit(1);
+	}
+	index_used = 0;
+	for (i = 0; i < old_size; i++)
+	{
+		if (old_index[i].id != None)
+		{
+			index_insert(old_index[i].id, old_index[i].c);
+		}
+	}
+	free(old_index);
+}
+
+/* Called once the client has both a window and a frame. */
+
+void index_client(Client *c)
+{
+	if ((index_used + 2) * 2 > index_size)
+	{
+		index_grow();
+	}
+	index_insert(c->window, c);
+	index_insert(c->frame, c);
+}
+
+void unindex_client(Client *c)
+{
+	index_delete(c->window);
+	index_delete(c->frame);
+}
+
+Client *find_client(Window w, int mode)
+{
+	unsigned int i;
+	Client *c;
+
+	if (client_index == NULL || w == None)
 	{
-		while (c != NULL)
+		return NULL;
+	}
+	for (i = hash_xid(w); client_index[i].id != None; i = (i + 1) & (index_size - 1))
+	{
+		if (client_index[i].id == w)
 		{
-			if (c->window == w)
+			c = client_index[i].c;
+			if (mode == FRAME)
 			{
-				return c;
+				return (c->frame == w) ? c : NULL;
+			}
+			else // WINDOW
+			{
+				return (c->window == w) ? c : NULL;
 			}
-			c = c->next;
 		}
 	}
 	return NULL;
@@ -67,7 +178,7 @@ void set_wm_state(Client *c, int state)
  * state was explicitly removed (Clients are allowed to either set the
  * atom to Withdrawn or just remove it... yuck.) */
 
-long get_wm_state(Client *c)
+long get_wm_state(Window w)
 {
 	Atom real_type;
 	int real_format;
@@ -75,7 +186,7 @@ long get_wm_state(Client *c)
 	unsigned long items_read, items_left;
 	unsigned char *data;
 
-	if (XGetWindowProperty(dsply, c->window, wm_state, 0L, 2L, False, wm_state, &real_type, &real_format, &items_read, &items_left, &data) == Success && items_read)
+	if (ROUNDTRIP(XGetWindowProperty(dsply, w, wm_state, 0L, 2L, False, wm_state, &real_type, &real_format, &items_read, &items_left, &data)) == Success && items_read)
 	{
 		state = *(long *)data;
 		XFree(data);
@@ -104,12 +215,205 @@ void send_config(Client *c)
 	XSendEvent(dsply, c->window, False, StructureNotifyMask, (XEvent *)&ce);
 }
 
+/* Rather than repainting a titlebar, a task button or the taskbar
+ * every time something about it changes, which can mean several
+ * repaints of the same thing for one batch of events, we mark it
+ * dirty and paint everything that's dirty once, when there are no
+ * more events waiting to be handled (see next_xevent)
+ * or on each pass of a drag loop. A full taskbar repaint covers any
+ * task buttons that were waiting. */
+
+PaintStats paint_stats;
+static unsigned int dirty_clients = 0;
+static Bool taskbar_dirty = False;
+
+static void set_dirty(Client *c, unsigned int what)
+{
+	if (!c->dirty)
+	{
+		dirty_clients++;
+	}
+	c->dirty |= what;
+}
+
+static void mark_dirty(Client *c, unsigned int what)
+{
+	if (!defer_work(c, what))
+	{
+		set_dirty(c, what);
+	}
+}
+
+void schedule_redraw(Client *c)
+{
+	paint_stats.frame_requests++;
+	mark_dirty(c, DIRTY_FRAME);
+}
+
+void schedule_taskbutton_redraw(Client *c)
+{
+	paint_stats.taskbutton_requests++;
+	mark_dirty(c, DIRTY_TASKBUTTON);
+}
+
+void schedule_taskbar_redraw(void)
+{
+	paint_stats.taskbar_requests++;
+	taskbar_dirty = True;
+}
+
+void flush_redraws(void)
+{
+	Client *c;
+	Mark mark;
+
+	if (dirty_clients == 0 && !taskbar_dirty)
+	{
+		return;
+	}
+	start_mark(&mark);
+	for (c = head_client; c != NULL && dirty_clients > 0; c = c->next)
+	{
+		if (c->dirty)
+		{
+			if (c->dirty & DIRTY_FRAME)
+			{
+				paint_stats.frame_paints++;
+				redraw(c);
+			}
+			if ((c->dirty & DIRTY_TASKBUTTON) && !taskbar_dirty)
+			{
+				paint_stats.taskbutton_paints++;
+				redraw_taskbutton(c);
+			}
+			c->dirty = 0;
+			dirty_clients--;
+		}
+	}
+	if (taskbar_dirty)
+	{
+		taskbar_dirty = False;
+		paint_stats.taskbar_paints++;
+		redraw_taskbar();
+	}
+	record_handler(STAT_PAINT, &mark);
+}
+
+/* Every event a client sends us (as opposed to ones the user or the
+ * server cause) costs it a token from a bucket that holds FLOOD_BURST
+ * and is topped up at FLOOD_RATE a second. While a client's bucket is
+ * empty, repainting its titlebar and task button and reshaping its
+ * frame is put off for FLOOD_DELAY, however many times it's asked
+ * for in the meantime, so a client that sends a storm of
+ * ConfigureRequests or title changes gets a few repaints a second
+ * rather than hundreds, and can't crowd out everyone else. Moving and
+ * resizing what it asks for isn't cosmetic, so that's never held up.
+ * Only the work its own events cause is put off: repaints for a focus
+ * change, an Expose or anything else the user or another client does
+ * are done straight away, so its titlebar never shows the wrong
+ * focus. */
+
+#define FLOOD_TOKEN_NS (1000000000ULL / FLOOD_RATE)
+
+static Client *charged = NULL; // the sender of the event being handled
+
+static void refill_tokens(Client *c)
+{
+	unsigned long long earned = (get_time_ns() - c->tokens_at) / FLOOD_TOKEN_NS;
+
+	if (earned == 0)
+	{
+		return;
+	}
+	c->tokens_at += earned * FLOOD_TOKEN_NS;
+	if (earned >= FLOOD_BURST - c->tokens)
+	{
+		c->tokens = FLOOD_BURST;
+	}
+	else
+	{
+		c->tokens += earned;
+	}
+}
+
+void charge_client(Client *c)
+{
+	charged = c;
+	refill_tokens(c);
+	c->flood.events++;
+	if (c->tokens > 0)
+	{
+		c->tokens--;
+	}
+	else
+	{
+		c->flood.over++;
+	}
+}
+
+static void do_deferred_work(void *data)
+{
+	Client *c = (Client *)data;
+	unsigned int what = c->deferred;
+
+	c->flood_timer = NULL;
+	c->deferred = 0;
+	if (what & (DIRTY_FRAME|DIRTY_TASKBUTTON))
+	{
+		set_dirty(c, what & (DIRTY_FRAME|DIRTY_TASKBUTTON));
+	}
+#ifdef SHAPE
+	if (what & DIRTY_SHAPE)
+	{
+		set_shape(c);
+	}
+#endif
+}
+
+// called once the event charge_client was called for has been handled
+void charge_done(void)
+{
+	charged = NULL;
+}
+
+/* Returns True if the work has been put off, in which case it'll be
+ * done by do_deferred_work. */
+
+Bool defer_work(Client *c, unsigned int what)
+{
+	if (c != charged)
+	{
+		return False;
+	}
+	refill_tokens(c);
+	if (c->tokens > 0 && c->flood_timer == NULL)
+	{
+		return False;
+	}
+	if ((c->deferred & what) == what)
+	{
+		c->flood.merged++;
+	}
+	else
+	{
+		c->flood.deferred++;
+	}
+	c->deferred |= what;
+	if (c->flood_timer == NULL)
+	{
+		c->flood_timer = add_timer(FLOOD_DELAY, 0, do_deferred_work, c);
+	}
+	return True;
+}
+
 /* After pulling my hair out trying to find some way to tell if a
  * window is still valid, I've decided to instead carefully ignore any
  * errors raised by this function. We know that the X calls are, and
  * we know the only reason why they could fail -- a window has removed
  * itself completely before the Unmap and Destroy events get through
- * the queue to us. It's not absolutely perfect, but it works.
+ * the queue to us. The errors are ignored by sequence number (see
+ * ignore_errors), so we neither grab the server nor wait for it to
+ * catch up, and other clients carry on while a window closes.
  *
  * The 'withdrawing' argument specifies if the client is actually
  * (destroying itself||being destroyed by us) or if we are merely
@@ -117,10 +421,11 @@ void send_config(Client *c)
 
 void remove_client(Client *c, int mode)
 {
-	Client *p;
+	Mark mark;
+
+	start_mark(&mark);
 
-	XGrabServer(dsply);
-	XSetErrorHandler(ignore_xerror);
+	ignore_errors();
 
 #ifdef DEBUG
 	err("removing %s, %d: %d left", c->name, mode, XPending(dsply));
@@ -149,20 +454,27 @@ void remove_client(Client *c, int mode)
 #endif
 	XRemoveFromSaveSet(dsply, c->window);
 	XDestroyWindow(dsply, c->frame);
+	heed_errors();
+	client_removed(c);
+	unindex_client(c);
+	forget_focus(c);
+	invalidate_taskbar_layout();
 
-	if (head_client == c)
+	if (c->prev != NULL)
+	{
+		c->prev->next = c->next;
+	}
+	else
 	{
 		head_client = c->next;
 	}
+	if (c->next != NULL)
+	{
+		c->next->prev = c->prev;
+	}
 	else
 	{
-		for (p = head_client; p && p->next; p = p->next)
-		{
-			if (p->next == c)
-			{
-				p->next = c->next;
-			}
-		}
+		tail_client = c->prev;
 	}
 	if (c->name != NULL)
 	{
@@ -181,17 +493,219 @@ void remove_client(Client *c, int mode)
 		focused_client = NULL;
 		check_focus(get_prev_focused());
 	}
+	if (c->dirty)
+	{
+		dirty_clients--;
+	}
+	if (c->flood_timer != NULL)
+	{
+		cancel_timer(c->flood_timer);
+	}
+	if (c == charged)
+	{
+		charged = NULL;
+	}
 	free(c);
 
-	XSync(dsply, False);
-	XSetErrorHandler(handle_xerror);
-	XUngrabServer(dsply);
+	schedule_taskbar_redraw();
+	record_handler(STAT_UNMANAGE, &mark);
+}
+
+/* Titles are cut down to fit the space they're drawn in, and end in
+ * an ellipsis if they had to be cut, so a long name (a URL, a shell
+ * command) doesn't send the server a pile of glyphs it would only clip
+ * away. The name's length and width are worked out once, and how much
+ * of it fits is remembered for the titlebar and the task button
+ * separately; both are only worked out again when the name changes
+ * (see invalidate_title) or the space it has to fit in does.
+ *
+ * Some clients change their name many times a second (a terminal
+ * showing a progress count, say), so a PropertyNotify only marks the
+ * name stale, and update_title fetches it when something that shows
+ * it is about to be painted. However often it changed in between,
+ * that's one round trip. No more of it is fetched than could be
+ * shown either: title_fetch_length asks for as many of the narrowest
+ * character as would fill the screen or the window, whichever is
+ * wider, so anything past that would only be cut off anyway. new.c
+ * fetches the name it starts a client with the same way. */
+
+#define ELLIPSIS "..."
+
+static int ellipsis_width = -1;
+static int min_char_width = -1;
 
-	redraw_taskbar();
+static int text_width(char *s, int len)
+{
+#ifdef XFT
+	XGlyphInfo extents;
+
+	XftTextExtents8(dsply, xftfont, (unsigned char *)s, len, &extents);
+	return extents.xOff;
+#else
+	return XTextWidth(font, s, len);
+#endif
+}
+
+void invalidate_title(Client *c)
+{
+	c->name_len = -1;
+	c->bar_fit.avail = FIT_UNKNOWN;
+	c->button_fit.avail = FIT_UNKNOWN;
+}
+
+/* How many 32 bit units of WM_NAME to ask for, for a window that's
+ * width pixels wide. */
+
+long title_fetch_length(int width)
+{
+	int widest = DisplayWidth(dsply, screen);
+#ifdef XFT
+	unsigned char ch;
+	int w;
+
+	if (min_char_width < 0)
+	{
+		// the names are Latin-1, so only those characters matter
+		for (ch = ' '; ch != 0; ch++)
+		{
+			w = text_width((char *)&ch, 1);
+			if (ch != 127 && w > 0 && (min_char_width < 0 || w < min_char_width))
+			{
+				min_char_width = w;
+			}
+		}
+	}
+#else
+	if (min_char_width < 0)
+	{
+		min_char_width = font->min_bounds.width;
+	}
+#endif
+	if (min_char_width < 1)
+	{
+		min_char_width = 1;
+	}
+	if (width > widest)
+	{
+		widest = width;
+	}
+	return (widest / min_char_width + 1 + 3) / 4;
+}
+
+/* Fetch as much of w's name as title_fetch_length allows, or NULL if
+ * it hasn't one. Like XFetchName, we only take it if it's a STRING. */
+
+char *fetch_title(Window w, int width)
+{
+	Atom type;
+	int format;
+	unsigned long nitems, after;
+	unsigned char *data = NULL;
+
+	if (ROUNDTRIP(XGetWindowProperty(dsply, w, XA_WM_NAME, 0, title_fetch_length(width), False, XA_STRING, &type, &format, &nitems, &after, &data)) != Success || data == NULL)
+	{
+		return NULL;
+	}
+	if (type != XA_STRING || format != 8)
+	{
+		XFree(data);
+		return NULL;
+	}
+	return (char *)data; // Xlib always null terminates it
+}
+
+void update_title(Client *c)
+{
+	if (!c->name_stale || c->trans)
+	{
+		return;
+	}
+	c->name_stale = False;
+	if (c->name != NULL)
+	{
+		XFree(c->name);
+		c->name = NULL;
+	}
+	c->name = fetch_title(c->window, c->width);
+	invalidate_title(c);
 }
 
+TitleFit *fit_title(Client *c, TitleFit *fit, int avail)
+{
+	int lo, hi, mid;
+
+	if (c->name_len < 0)
+	{
+		c->name_len = c->name ? strlen(c->name) : 0;
+		c->name_width = c->name ? text_width(c->name, c->name_len) : 0;
+	}
+	if (fit->avail == avail)
+	{
+		return fit;
+	}
+	fit->avail = avail;
+	if (c->name_width <= avail)
+	{
+		fit->len = c->name_len;
+		fit->width = c->name_width;
+		fit->ellipsis = False;
+		return fit;
+	}
+	if (ellipsis_width < 0)
+	{
+		ellipsis_width = text_width(ELLIPSIS, strlen(ELLIPSIS));
+	}
+	// find the longest prefix that leaves room for the ellipsis
+	lo = 0;
+	hi = c->name_len;
+	while (hi - lo > 1)
+	{
+		mid = lo + (hi - lo) / 2;
+		if (text_width(c->name, mid) + ellipsis_width <= avail)
+		{
+			lo = mid;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	fit->len = lo;
+	fit->width = text_width(c->name, lo);
+	fit->ellipsis = (ellipsis_width <= avail);
+	return fit;
+}
+
+#ifdef XFT
+void draw_title(Client *c, TitleFit *fit, XftDraw *d, int x)
+{
+	if (fit->len > 0)
+	{
+		XftDrawString8(d, &xft_detail, xftfont, x, SPACE + xftfont->ascent, (unsigned char *)c->name, fit->len);
+	}
+	if (fit->ellipsis)
+	{
+		XftDrawString8(d, &xft_detail, xftfont, x + fit->width, SPACE + xftfont->ascent, (unsigned char *)ELLIPSIS, strlen(ELLIPSIS));
+	}
+}
+#else
+void draw_title(Client *c, TitleFit *fit, Drawable d, int x)
+{
+	if (fit->len > 0)
+	{
+		XDrawString(dsply, d, text_gc, x, SPACE + font->ascent, c->name, fit->len);
+	}
+	if (fit->ellipsis)
+	{
+		XDrawString(dsply, d, text_gc, x + fit->width, SPACE + font->ascent, ELLIPSIS, strlen(ELLIPSIS));
+	}
+}
+#endif
+
 void redraw(Client *c)
 {
+	TitleFit *fit;
+
 	if (c == fullscreen_client)
 	{
 		return;
@@ -212,26 +726,17 @@ void redraw(Client *c)
 	{
 		XFillRectangle(dsply, c->frame, inactive_gc, 0, 0, c->width - ((BARHEIGHT() - DEF_BORDERWIDTH) * 3), BARHEIGHT() - DEF_BORDERWIDTH);
 	}
+	update_title(c);
 	if (!c->trans && c->name != NULL)
 	{
+		fit = fit_title(c, &c->bar_fit, c->width - ((BARHEIGHT() - DEF_BORDERWIDTH) * 3) - (SPACE * 2));
 #ifdef XFT
-		XftDrawString8(c->xftdraw, &xft_detail, xftfont, SPACE, SPACE + xftfont->ascent, (unsigned char *)c->name, strlen(c->name));
+		draw_title(c, fit, c->xftdraw, SPACE);
 #else
-		XDrawString(dsply, c->frame, text_gc, SPACE, SPACE + font->ascent, c->name, strlen(c->name));
+		draw_title(c, fit, c->frame, SPACE);
 #endif
 	}
-	if (c == focused_client)
-	{
-		draw_hide_button(c, &text_gc, &active_gc);
-		draw_toggledepth_button(c, &text_gc, &active_gc);
-		draw_close_button(c, &text_gc, &active_gc);
-	}
-	else
-	{
-		draw_hide_button(c, &text_gc, &inactive_gc);
-		draw_toggledepth_button(c, &text_gc, &inactive_gc);
-		draw_close_button(c, &text_gc, &inactive_gc);
-	}
+	draw_buttons(c, (c == focused_client) ? BUTTON_ACTIVE : BUTTON_INACTIVE);
 }
 
 /* Window gravity is a mess to explain, but we don't need to do much
@@ -271,45 +776,129 @@ void gravitate(Client *c, int multiplier)
  * that using X borders would get me eventually... ;-)) */
 
 #ifdef SHAPE
-void set_shape(Client *c)
+/* Whether the client is shaped at all is looked up once, with
+ * XShapeQueryExtents, when we take it on, and after that we're told by
+ * ShapeNotify (see shape_changed), so we never have to fetch its
+ * rectangles to find out. The frame's shape is only worked out again
+ * when the client's shape or the frame's size has changed since it
+ * last was; shape_width is -1 when it has to be. */
+
+void query_shape(Client *c)
 {
-	int n, order;
-	XRectangle temp, *dummy;
-
-	dummy = XShapeGetRectangles(dsply, c->window, ShapeBounding, &n, &order);
-	if (n > 1)
-	{
-		XShapeCombineShape(dsply, c->frame, ShapeBounding, 0, BARHEIGHT(), c->window, ShapeBounding, ShapeSet);
-		temp.x = -BORDERWIDTH(c);
-		temp.y = -BORDERWIDTH(c);
-		temp.width = c->width + (2 * BORDERWIDTH(c));
-		temp.height = BARHEIGHT() + BORDERWIDTH(c);
-		XShapeCombineRectangles(dsply, c->frame, ShapeBounding, 0, 0, &temp, 1, ShapeUnion, YXBanded);
-		temp.x = 0;
-		temp.y = 0;
-		temp.width = c->width;
-		temp.height = BARHEIGHT() - BORDERWIDTH(c);
-		XShapeCombineRectangles(dsply, c->frame, ShapeClip, 0, BARHEIGHT(), &temp, 1, ShapeUnion, YXBanded);
-		c->has_been_shaped = 1;
+	int bounding_shaped, clip_shaped, dummy;
+	unsigned int udummy;
+
+	c->shaped = False;
+	if (ROUNDTRIP(XShapeQueryExtents(dsply, c->window, &bounding_shaped, &dummy, &dummy, &udummy, &udummy, &clip_shaped, &dummy, &dummy, &udummy, &udummy)))
+	{
+		c->shaped = bounding_shaped;
 	}
-	else
+	c->shape_width = -1;
+}
+
+// for a ShapeNotify about the client's bounding shape
+void shape_changed(Client *c, XShapeEvent *e)
+{
+	c->shaped = e->shaped;
+	c->shape_width = -1;
+}
+
+void set_shape(Client *c)
+{
+	XRectangle temp;
+
+	if (!c->shaped)
 	{
 		if (c->has_been_shaped)
 		{
-			// I can't find a 'remove all shaping' function...
-			temp.x = -BORDERWIDTH(c);
-			temp.y = -BORDERWIDTH(c);
-			temp.width = c->width + (2 * BORDERWIDTH(c));
-			temp.height = c->height + BARHEIGHT() + (2 * BORDERWIDTH(c));
-			XShapeCombineRectangles(dsply, c->frame, ShapeBounding, 0, 0, &temp, 1, ShapeSet, YXBanded);
+			XShapeCombineMask(dsply, c->frame, ShapeBounding, 0, 0, None, ShapeSet);
+			XShapeCombineMask(dsply, c->frame, ShapeClip, 0, 0, None, ShapeSet);
+			c->has_been_shaped = 0;
 		}
+		return;
 	}
-	XFree(dummy);
+	if (c->has_been_shaped && c->shape_width == c->width && c->shape_height == c->height)
+	{
+		return;
+	}
+	XShapeCombineShape(dsply, c->frame, ShapeBounding, 0, BARHEIGHT(), c->window, ShapeBounding, ShapeSet);
+	temp.x = -BORDERWIDTH(c);
+	temp.y = -BORDERWIDTH(c);
+	temp.width = c->width + (2 * BORDERWIDTH(c));
+	temp.height = BARHEIGHT() + BORDERWIDTH(c);
+	XShapeCombineRectangles(dsply, c->frame, ShapeBounding, 0, 0, &temp, 1, ShapeUnion, YXBanded);
+	temp.x = 0;
+	temp.y = 0;
+	temp.width = c->width;
+	temp.height = BARHEIGHT() - BORDERWIDTH(c);
+	XShapeCombineRectangles(dsply, c->frame, ShapeClip, 0, BARHEIGHT(), &temp, 1, ShapeUnion, YXBanded);
+	c->has_been_shaped = 1;
+	c->shape_width = c->width;
+	c->shape_height = c->height;
 }
 #endif
 
+/* The clients that have had the focus are kept in a list, most
+ * recently focused first, so when the focused client goes away the
+ * one to give the focus back to is the first one on it that isn't
+ * hidden. Hidden clients stay where they are, so one that's unhidden
+ * goes back to where it was, and clients that have never had the
+ * focus aren't on it at all. */
+
+static Client *focus_first = NULL, *focus_last = NULL;
+
+static Bool in_focus_history(Client *c)
+{
+	return c->focus_prev != NULL || focus_first == c;
+}
+
+void forget_focus(Client *c)
+{
+	if (!in_focus_history(c))
+	{
+		return;
+	}
+	if (c->focus_prev != NULL)
+	{
+		c->focus_prev->focus_next = c->focus_next;
+	}
+	else
+	{
+		focus_first = c->focus_next;
+	}
+	if (c->focus_next != NULL)
+	{
+		c->focus_next->focus_prev = c->focus_prev;
+	}
+	else
+	{
+		focus_last = c->focus_prev;
+	}
+	c->focus_prev = NULL;
+	c->focus_next = NULL;
+}
+
+static void push_focus_history(Client *c)
+{
+	forget_focus(c);
+	c->focus_prev = NULL;
+	c->focus_next = focus_first;
+	if (focus_first != NULL)
+	{
+		focus_first->focus_prev = c;
+	}
+	else
+	{
+		focus_last = c;
+	}
+	focus_first = c;
+}
+
 void check_focus(Client *c)
 {
+	Mark mark;
+
+	start_mark(&mark);
 	if (c != NULL)
 	{
 		XSetInputFocus(dsply, c->window, RevertToNone, CurrentTime);
@@ -319,78 +908,127 @@ void check_focus(Client *c)
 	{
 		Client *old_focused = focused_client;
 		focused_client = c;
-		focus_count++;
 		if (c != NULL)
 		{
-			c->focus_order = focus_count;
-			redraw(c);
+			push_focus_history(c);
+			schedule_redraw(c);
+			schedule_taskbutton_redraw(c);
 		}
 		if (old_focused != NULL)
 		{
-			redraw(old_focused);
+			schedule_redraw(old_focused);
+			schedule_taskbutton_redraw(old_focused);
 		}
-		redraw_taskbar();
 	}
+	record_handler(STAT_FOCUS, &mark);
 }
 
+// the most recently focused client that isn't hidden, or NULL
 Client *get_prev_focused(void)
 {
-	Client *c = head_client;
-	Client *prev_focused = NULL;
-	unsigned int highest = 0;
+	Client *c;
 
-	while (c != NULL)
+	for (c = focus_first; c != NULL && c->hidden; c = c->focus_next)
 	{
-		if (!c->hidden && c->focus_order > highest)
-		{
-			highest = c->focus_order;
-			prev_focused = c;
-		}
-		c = c->next;
+		continue;
 	}
-	return prev_focused;
+	return c;
 }
 
-void draw_hide_button(Client *c, GC *detail_gc, GC *background_gc)
+/* The titlebar buttons never change, so each one is drawn just once
+ * for each state into a strip held by the server: a row per state,
+ * with the hide, toggle depth and close buttons left to right just as
+ * they sit on the titlebar. Painting a button, or all three, is then
+ * one XCopyArea. */
+
+static Pixmap button_pm = None;
+
+static void paint_hide_glyph(int x, int y, GC detail_gc)
 {
-	int x, topleft_offset;
-	x = c->width - ((BARHEIGHT() - DEF_BORDERWIDTH) * 3);
+	int topleft_offset;
 	topleft_offset = (BARHEIGHT() / 2) - 5; // 5 being ~half of 9
-	XFillRectangle(dsply, c->frame, *background_gc, x, 0, BARHEIGHT() - DEF_BORDERWIDTH, BARHEIGHT() - DEF_BORDERWIDTH);
+	x += topleft_offset;
+	y += topleft_offset;
 
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 4, topleft_offset + 2, x + topleft_offset + 4, topleft_offset + 0);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 6, topleft_offset + 2, x + topleft_offset + 7, topleft_offset + 1);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 6, topleft_offset + 4, x + topleft_offset + 8, topleft_offset + 4);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 6, topleft_offset + 6, x + topleft_offset + 7, topleft_offset + 7);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 4, topleft_offset + 6, x + topleft_offset + 4, topleft_offset + 8);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 2, topleft_offset + 6, x + topleft_offset + 1, topleft_offset + 7);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 2, topleft_offset + 4, x + topleft_offset + 0, topleft_offset + 4);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 2, topleft_offset + 2, x + topleft_offset + 1, topleft_offset + 1);
+	XDrawLine(dsply, button_pm, detail_gc, x + 4, y + 2, x + 4, y + 0);
+	XDrawLine(dsply, button_pm, detail_gc, x + 6, y + 2, x + 7, y + 1);
+	XDrawLine(dsply, button_pm, detail_gc, x + 6, y + 4, x + 8, y + 4);
+	XDrawLine(dsply, button_pm, detail_gc, x + 6, y + 6, x + 7, y + 7);
+	XDrawLine(dsply, button_pm, detail_gc, x + 4, y + 6, x + 4, y + 8);
+	XDrawLine(dsply, button_pm, detail_gc, x + 2, y + 6, x + 1, y + 7);
+	XDrawLine(dsply, button_pm, detail_gc, x + 2, y + 4, x + 0, y + 4);
+	XDrawLine(dsply, button_pm, detail_gc, x + 2, y + 2, x + 1, y + 1);
 }
 
-void draw_toggledepth_button(Client *c, GC *detail_gc, GC *background_gc)
+static void paint_toggledepth_glyph(int x, int y, GC detail_gc)
 {
-	int x, topleft_offset;
-	x = c->width - ((BARHEIGHT() - DEF_BORDERWIDTH) * 2);
+	int topleft_offset;
 	topleft_offset = (BARHEIGHT() / 2) - 6; // 6 being ~half of 11
-	XFillRectangle(dsply, c->frame, *background_gc, x, 0, BARHEIGHT() - DEF_BORDERWIDTH, BARHEIGHT() - DEF_BORDERWIDTH);
+	x += topleft_offset;
+	y += topleft_offset;
 
-	XDrawRectangle(dsply, c->frame, *detail_gc, x + topleft_offset, topleft_offset, 7, 7);
-	XDrawRectangle(dsply, c->frame, *detail_gc, x + topleft_offset + 3, topleft_offset + 3, 7, 7);
+	XDrawRectangle(dsply, button_pm, detail_gc, x, y, 7, 7);
+	XDrawRectangle(dsply, button_pm, detail_gc, x + 3, y + 3, 7, 7);
 }
 
-void draw_close_button(Client *c, GC *detail_gc, GC *background_gc)
+static void paint_close_glyph(int x, int y, GC detail_gc)
 {
-	int x, topleft_offset;
-	x = c->width - (BARHEIGHT() - DEF_BORDERWIDTH);
+	int topleft_offset;
 	topleft_offset = (BARHEIGHT() / 2) - 5; // 5 being ~half of 9
-	XFillRectangle(dsply, c->frame, *background_gc, x, 0, BARHEIGHT() - DEF_BORDERWIDTH, BARHEIGHT() - DEF_BORDERWIDTH);
+	x += topleft_offset;
+	y += topleft_offset;
+
+	XDrawLine(dsply, button_pm, detail_gc, x + 1, y, x + 8, y + 7);
+	XDrawLine(dsply, button_pm, detail_gc, x + 1, y + 1, x + 7, y + 7);
+	XDrawLine(dsply, button_pm, detail_gc, x, y + 1, x + 7, y + 8);
+
+	XDrawLine(dsply, button_pm, detail_gc, x, y + 7, x + 7, y);
+	XDrawLine(dsply, button_pm, detail_gc, x + 1, y + 7, x + 7, y + 1);
+	XDrawLine(dsply, button_pm, detail_gc, x + 1, y + 8, x + 8, y + 1);
+}
+
+void make_button_pixmaps(void)
+{
+	int size = BARHEIGHT() - DEF_BORDERWIDTH;
+	GC background_gc[3];
+	int i;
+
+	background_gc[BUTTON_ACTIVE] = active_gc;
+	background_gc[BUTTON_INACTIVE] = inactive_gc;
+	background_gc[BUTTON_DEPRESSED] = depressed_gc;
+
+	button_pm = XCreatePixmap(dsply, root, size * 3, size * 3, DefaultDepth(dsply, screen));
+	for (i = 0; i < 3; i++)
+	{
+		XFillRectangle(dsply, button_pm, background_gc[i], 0, size * i, size * 3, size);
+		paint_hide_glyph(0, size * i, text_gc);
+		paint_toggledepth_glyph(size, size * i, text_gc);
+		paint_close_glyph(size * 2, size * i, text_gc);
+	}
+}
+
+static void copy_buttons(Client *c, int first, int count, int state)
+{
+	int size = BARHEIGHT() - DEF_BORDERWIDTH;
+	XCopyArea(dsply, button_pm, c->frame, text_gc, size * first, size * state, size * count, size, c->width - (size * (3 - first)), 0);
+}
+
+void draw_buttons(Client *c, int state)
+{
+	copy_buttons(c, 0, 3, state);
+}
+
+void draw_hide_button(Client *c, int state)
+{
+	copy_buttons(c, 0, 1, state);
+}
 
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 1, topleft_offset, x + topleft_offset + 8, topleft_offset + 7);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 1, topleft_offset + 1, x + topleft_offset + 7, topleft_offset + 7);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset, topleft_offset + 1, x + topleft_offset + 7, topleft_offset + 8);
+void draw_toggledepth_button(Client *c, int state)
+{
+	copy_buttons(c, 1, 1, state);
+}
 
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset, topleft_offset + 7, x + topleft_offset + 7, topleft_offset);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 1, topleft_offset + 7, x + topleft_offset + 7, topleft_offset + 1);
-	XDrawLine(dsply, c->frame, *detail_gc, x + topleft_offset + 1, topleft_offset + 8, x + topleft_offset + 8, topleft_offset + 1);
+void draw_close_button(Client *c, int state)
+{
+	copy_buttons(c, 2, 1, state);
 }
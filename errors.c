@@ -0,0 +1,281 @@
+/* WindowLab - an X11 window manager
+ * Copyright (c) 2001-2010 Nick Gravgaard
+ * me at nickgravgaard.com
+ * http://nickgravgaard.com/windowlab/
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include "windowlab.h"
+
+/* Xlib calls handle_xerror from wherever it happens to be reading the
+ * connection, which may be in the middle of one of our own requests,
+ * so all it does here is note the error down. Each error is tagged
+ * with the window we were busy with when the failed request was made
+ * (the subject of the event being handled, see requests_for), found
+ * from its sequence number, and the main loop deals with the queue
+ * between events. Nothing waits on the server to find out which
+ * errors belong to what. */
+
+#define MAX_RANGES 64
+#define MAX_QUEUED_ERRORS 64
+#define MAX_REMOVED 32
+
+// a run of requests, by sequence number, and the window they were for
+typedef struct SeqRange
+{
+	unsigned long first, last;
+	Window w;
+} SeqRange;
+
+typedef struct QueuedError
+{
+	XErrorEvent e;
+	Window w;
+} QueuedError;
+
+static void add_range(SeqRange *, int *, unsigned long, Window);
+static SeqRange *find_range(SeqRange *, int, unsigned long);
+static Bool was_removed(Window);
+
+static SeqRange ignored[MAX_RANGES], spans[MAX_RANGES];
+static int num_ignored = 0, num_spans = 0;
+static unsigned long ignore_from = 0, span_from = 0;
+static int ignore_depth = 0;
+static Window span_window = None;
+static QueuedError queued_errors[MAX_QUEUED_ERRORS];
+static int num_queued_errors = 0;
+static unsigned long dropped_errors = 0;
+static Window removed[MAX_REMOVED]; // windows and frames of recently removed clients
+static int next_removed = 0;
+
+int handle_xerror(Display *dsply, XErrorEvent *e)
+{
+	SeqRange *span;
+
+	(void) dsply; // fixes a warning
+	if (e->error_code == BadAccess && e->resourceid == root)
+	{
+		err("root window unavailable (maybe another wm is running?)");
+		exit(1);
+	}
+	// errors from a synchronous call come in before heed_errors is reached
+	if ((ignore_depth > 0 && e->serial >= ignore_from) || find_range(ignored, num_ignored, e->serial) != NULL)
+	{
+		return 0;
+	}
+	if (num_queued_errors == MAX_QUEUED_ERRORS)
+	{
+		dropped_errors++;
+		return 0;
+	}
+	queued_errors[num_queued_errors].e = *e;
+	if (span_window != None && e->serial >= span_from)
+	{
+		queued_errors[num_queued_errors].w = span_window;
+	}
+	else
+	{
+		span = find_range(spans, num_spans, e->serial);
+		queued_errors[num_queued_errors].w = (span != NULL) ? span->w : None;
+	}
+	num_queued_errors++;
+	return 0;
+}
+
+/* Called from the main loop, between events. A failed request on a
+ * window we manage means the window has gone, so we stop managing it,
+ * as we always have. An error from a request made for (or on) a
+ * client we've just stopped managing is only the tail end of it going
+ * away, and isn't worth a message. Anything else is reported, even if
+ * it's for a window we never managed, such as the taskbar. */
+
+void handle_queued_errors(void)
+{
+	QueuedError qe;
+	Client *c, *owner;
+	char msg[255];
+	int i;
+
+	// remove_client may make more, so take them one at a time off the front
+	while (num_queued_errors > 0)
+	{
+		qe = queued_errors[0];
+		num_queued_errors--;
+		for (i = 0; i < num_queued_errors; i++)
+		{
+			queued_errors[i] = queued_errors[i + 1];
+		}
+
+		c = find_client(qe.e.resourceid, WINDOW);
+		owner = NULL;
+		if (qe.w != None)
+		{
+			owner = find_client(qe.w, WINDOW);
+			if (owner == NULL)
+			{
+				owner = find_client(qe.w, FRAME);
+			}
+		}
+		if (c == NULL && owner == NULL && (was_removed(qe.w) || was_removed(qe.e.resourceid)))
+		{
+#ifdef DEBUG
+			err("X error (%#lx) for departed window %#lx ignored", qe.e.resourceid, qe.w);
+#endif
+			continue;
+		}
+		XGetErrorText(dsply, qe.e.error_code, msg, sizeof msg);
+		if (owner != NULL)
+		{
+			err("X error (%#lx) in request %d for %s: %s", qe.e.resourceid, qe.e.request_code, owner->name ? owner->name : "(unnamed)", msg);
+		}
+		else
+		{
+			err("X error (%#lx) in request %d: %s", qe.e.resourceid, qe.e.request_code, msg);
+		}
+		if (c != NULL)
+		{
+			remove_client(c, WITHDRAW);
+		}
+	}
+	if (dropped_errors != 0)
+	{
+		err("%lu more X errors dropped", dropped_errors);
+		dropped_errors = 0;
+	}
+}
+
+/* remove_client calls this, so that errors from the requests still on
+ * their way for the client can be recognised as such. Only the last
+ * few are remembered: by the time many more have gone, the server has
+ * long since got past the requests for this one. */
+
+void client_removed(Client *c)
+{
+	removed[next_removed] = c->window;
+	next_removed = (next_removed + 1) % MAX_REMOVED;
+	removed[next_removed] = c->frame;
+	next_removed = (next_removed + 1) % MAX_REMOVED;
+}
+
+static Bool was_removed(Window w)
+{
+	int i;
+
+	if (w == None)
+	{
+		return False;
+	}
+	for (i = 0; i < MAX_REMOVED; i++)
+	{
+		if (removed[i] == w)
+		{
+			return True;
+		}
+	}
+	return False;
+}
+
+/* The requests made between requests_for(w) and requests_done() are
+ * remembered as being for w (zero if none were made), until the
+ * server has got past them and any errors they caused have been
+ * read. The event loop brackets each event it handles with these. */
+
+void requests_for(Window w)
+{
+	span_window = w;
+	span_from = NextRequest(dsply);
+}
+
+void requests_done(void)
+{
+	if (span_window != None)
+	{
+		add_range(spans, &num_spans, span_from, span_window);
+		span_window = None;
+	}
+}
+
+/* Rather than grab the server while we do something that may race
+ * with a client destroying its window, we go ahead and ignore any
+ * errors from the requests made between ignore_errors and
+ * heed_errors. The errors are picked out by sequence number, so this
+ * costs nothing on the wire and we don't have to wait for the server
+ * to catch up before carrying on. The pairs can nest. */
+
+void ignore_errors(void)
+{
+	if (ignore_depth++ == 0)
+	{
+		ignore_from = NextRequest(dsply);
+	}
+}
+
+void heed_errors(void)
+{
+	if (--ignore_depth == 0)
+	{
+		add_range(ignored, &num_ignored, ignore_from, None);
+	}
+}
+
+/* Add the requests from first up to the last one made so far to the
+ * table, first dropping any the server has got past, as every error
+ * from those has already been through handle_xerror. If the table is
+ * still full, the oldest range goes. */
+
+static void add_range(SeqRange *ranges, int *count, unsigned long first, Window w)
+{
+	unsigned long last = NextRequest(dsply) - 1;
+	unsigned long done = LastKnownRequestProcessed(dsply);
+	int i, n = 0;
+
+	for (i = 0; i < *count; i++)
+	{
+		if (ranges[i].last > done)
+		{
+			ranges[n++] = ranges[i];
+		}
+	}
+	*count = n;
+	if (last < first)
+	{
+		return; // nothing was sent
+	}
+	if (*count == MAX_RANGES)
+	{
+		memmove(&ranges[0], &ranges[1], (MAX_RANGES - 1) * sizeof ranges[0]);
+		(*count)--;
+	}
+	ranges[*count].first = first;
+	ranges[*count].last = last;
+	ranges[*count].w = w;
+	(*count)++;
+}
+
+static SeqRange *find_range(SeqRange *ranges, int count, unsigned long serial)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		if (serial >= ranges[i].first && serial <= ranges[i].last)
+		{
+			return &ranges[i];
+		}
+	}
+	return NULL;
+}
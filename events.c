@@ -21,13 +21,21 @@
 #include <X11/Xatom.h>
 #include "windowlab.h"
 
+static Window event_window(XEvent *);
+static Client *event_sender(XEvent *);
+static int next_event(XEvent *);
+static Bool is_input(XEvent *);
+static Bool merge_event(XEvent *);
+static void merge_configure(XConfigureRequestEvent *, XConfigureRequestEvent *);
+static void merge_expose(XExposeEvent *, XExposeEvent *);
 static void handle_key_press(XKeyEvent *);
 static void handle_button_press(XButtonEvent *);
 static void handle_windowbar_click(XButtonEvent *, Client *);
 static unsigned int box_clicked(Client *, int);
-static void draw_button(Client *, GC *, GC *, unsigned int);
+static void draw_button(Client *, int, unsigned int);
 static void handle_configure_request(XConfigureRequestEvent *);
 static void handle_map_request(XMapRequestEvent *);
+static void handle_map_event(XMapEvent *);
 static void handle_unmap_event(XUnmapEvent *);
 static void handle_destroy_event(XDestroyWindowEvent *);
 static void handle_client_message(XClientMessageEvent *);
@@ -39,7 +47,251 @@ static void handle_expose_event(XExposeEvent *);
 static void handle_shape_change(XShapeEvent *);
 #endif
 
-static int interruptible_XNextEvent(XEvent *event);
+/* The window an event is about, which for the ones sent to us as the
+ * parent isn't the one it was delivered to. */
+
+static Window event_window(XEvent *ev)
+{
+	switch (ev->type)
+	{
+		case MapRequest:
+			return ev->xmaprequest.window;
+		case ConfigureRequest:
+			return ev->xconfigurerequest.window;
+		case MapNotify:
+			return ev->xmap.window;
+		case UnmapNotify:
+			return ev->xunmap.window;
+		case DestroyNotify:
+			return ev->xdestroywindow.window;
+		default:
+			return ev->xany.window;
+	}
+}
+
+/* The client that sent an event, if it came from a client rather
+ * than the user or the server; it's charged for it (see charge_client). */
+
+static Client *event_sender(XEvent *ev)
+{
+	switch (ev->type)
+	{
+		case ConfigureRequest:
+			return find_client(ev->xconfigurerequest.window, WINDOW);
+		case PropertyNotify:
+		case ClientMessage:
+		case ColormapNotify:
+			return find_client(ev->xany.window, WINDOW);
+		default:
+#ifdef SHAPE
+			if (shape && ev->type == shape_event)
+			{
+				return find_client(((XShapeEvent *)ev)->window, WINDOW);
+			}
+#endif
+			return NULL;
+	}
+}
+
+/* Before the events that have already arrived are dispatched, they're
+ * taken off Xlib's queue as a batch, and any that only repeat one
+ * that's still waiting in the batch are merged into it: several
+ * ConfigureRequests for a window become one asking for all of the
+ * changes, Exposes on a window become one covering all of them, and
+ * only the last of a run of PropertyNotifys for a property, or
+ * ShapeNotifys for a window, is kept. The merged event takes the
+ * first one's place, and a different kind of event for the same
+ * window stops anything after it being merged into anything before
+ * it, so a window's events are still handled in the order they came.
+ *
+ * Input events are never batched, as the drag and menu loops take the
+ * events that follow them straight off Xlib's queue: when we get to
+ * one the batch ends there, and it's only dispatched (on its own)
+ * once everything before it has been.
+ *
+ * Events are recorded (with -record) as they're dispatched rather than
+ * as they're batched, as log_xevent looks at the state of the clients
+ * they're for, which the events ahead of them in the batch may change. */
+
+#define MAX_BATCH 256
+
+CoalesceStats coalesce_stats;
+static XEvent batch[MAX_BATCH];
+static int batch_len = 0, batch_next = 0;
+
+static int next_event(XEvent *ev)
+{
+	XEvent peek;
+
+	if (batch_next < batch_len)
+	{
+		*ev = batch[batch_next++];
+		return 1;
+	}
+	if (!next_xevent(ev))
+	{
+		return 0;
+	}
+	coalesce_stats.received++;
+	if (is_input(ev))
+	{
+		return 1;
+	}
+	batch[0] = *ev;
+	batch_len = 1;
+	batch_next = 0;
+	while (batch_len < MAX_BATCH && XEventsQueued(dsply, QueuedAlready) > 0)
+	{
+		XPeekEvent(dsply, &peek);
+		if (is_input(&peek))
+		{
+			break;
+		}
+		XNextEvent(dsply, &peek);
+		coalesce_stats.received++;
+		if (!merge_event(&peek))
+		{
+			batch[batch_len++] = peek;
+		}
+	}
+	*ev = batch[batch_next++];
+	return 1;
+}
+
+static Bool is_input(XEvent *ev)
+{
+	switch (ev->type)
+	{
+		case KeyPress:
+		case KeyRelease:
+		case ButtonPress:
+		case ButtonRelease:
+		case MotionNotify:
+		case EnterNotify:
+		case LeaveNotify:
+			return True;
+		default:
+			return False;
+	}
+}
+
+// True if ev has been merged into an event already in the batch
+static Bool merge_event(XEvent *ev)
+{
+	Window w = event_window(ev);
+	XEvent *b;
+	int i;
+
+	for (i = batch_len - 1; i >= batch_next; i--)
+	{
+		b = &batch[i];
+		if (event_window(b) != w)
+		{
+			continue;
+		}
+		if (b->type != ev->type)
+		{
+			return False;
+		}
+		switch (ev->type)
+		{
+			case ConfigureRequest:
+				merge_configure(&b->xconfigurerequest, &ev->xconfigurerequest);
+				coalesce_stats.configures++;
+				return True;
+			case Expose:
+				merge_expose(&b->xexpose, &ev->xexpose);
+				coalesce_stats.exposes++;
+				return True;
+			case PropertyNotify:
+				if (b->xproperty.atom != ev->xproperty.atom)
+				{
+					continue;
+				}
+				*b = *ev;
+				coalesce_stats.properties++;
+				return True;
+			default:
+#ifdef SHAPE
+				if (shape && ev->type == shape_event)
+				{
+					if (((XShapeEvent *)b)->kind != ((XShapeEvent *)ev)->kind)
+					{
+						continue;
+					}
+					*b = *ev;
+					coalesce_stats.shapes++;
+					return True;
+				}
+#endif
+				return False;
+		}
+	}
+	return False;
+}
+
+static void merge_configure(XConfigureRequestEvent *into, XConfigureRequestEvent *e)
+{
+	if (e->value_mask & CWX)
+	{
+		into->x = e->x;
+	}
+	if (e->value_mask & CWY)
+	{
+		into->y = e->y;
+	}
+	if (e->value_mask & CWWidth)
+	{
+		into->width = e->width;
+	}
+	if (e->value_mask & CWHeight)
+	{
+		into->height = e->height;
+	}
+	if (e->value_mask & CWBorderWidth)
+	{
+		into->border_width = e->border_width;
+	}
+	if (e->value_mask & CWSibling)
+	{
+		into->above = e->above;
+	}
+	if (e->value_mask & CWStackMode)
+	{
+		into->detail = e->detail;
+	}
+	into->value_mask |= e->value_mask;
+	into->serial = e->serial;
+}
+
+/* The merged Expose covers both areas, and has the later one's count,
+ * as that's how many more are still to come. */
+
+static void merge_expose(XExposeEvent *into, XExposeEvent *e)
+{
+	int x2 = into->x + into->width, y2 = into->y + into->height;
+
+	if (e->x + e->width > x2)
+	{
+		x2 = e->x + e->width;
+	}
+	if (e->y + e->height > y2)
+	{
+		y2 = e->y + e->height;
+	}
+	if (e->x < into->x)
+	{
+		into->x = e->x;
+	}
+	if (e->y < into->y)
+	{
+		into->y = e->y;
+	}
+	into->width = x2 - into->x;
+	into->height = y2 - into->y;
+	into->count = e->count;
+	into->serial = e->serial;
+}
 
 /* We may want to put in some sort of check for unknown events at some
  * point. TWM has an interesting and different way of doing this... */
@@ -47,20 +299,26 @@ static int interruptible_XNextEvent(XEvent *event);
 void do_event_loop(void)
 {
 	XEvent ev;
+	Mark mark;
+	Client *sender;
 
 	for (;;)
 	{
-		interruptible_XNextEvent(&ev);
+		if (!next_event(&ev))
+		{
+			continue;
+		}
+		log_xevent(&ev);
 #ifdef DEBUG
 		show_event(ev);
 #endif
-		/* check to see if menu rebuild has been requested */
-		if (do_menuitems)
+
+		start_mark(&mark);
+		requests_for(event_window(&ev));
+		if ((sender = event_sender(&ev)) != NULL)
 		{
-			free_menuitems();
-			get_menuitems();
+			charge_client(sender);
 		}
-
 		switch (ev.type)
 		{
 			case KeyPress:
@@ -75,6 +333,9 @@ void do_event_loop(void)
 			case MapRequest:
 				handle_map_request(&ev.xmaprequest);
 				break;
+			case MapNotify:
+				handle_map_event(&ev.xmap);
+				break;
 			case UnmapNotify:
 				handle_unmap_event(&ev.xunmap);
 				break;
@@ -104,6 +365,10 @@ void do_event_loop(void)
 				}
 #endif
 		}
+		requests_done();
+		charge_done();
+		handle_queued_errors();
+		record_event(ev.type, &mark);
 	}
 }
 
@@ -140,7 +405,7 @@ static void handle_button_press(XButtonEvent *e)
 	{
 		if (focused_client != NULL && focused_client != fullscreen_client)
 		{
-			resize(focused_client, e->x_root, e->y_root);
+			TIMED(STAT_RESIZE, resize(focused_client, e->x_root, e->y_root));
 		}
 		else
 		{
@@ -155,7 +420,7 @@ static void handle_button_press(XButtonEvent *e)
 #endif
 		if (e->button == Button3)
 		{
-			rclick_root();
+			TIMED(STAT_TASKBAR, rclick_root());
 		}
 	}
 	else if (e->window == taskbar)
@@ -163,10 +428,10 @@ static void handle_button_press(XButtonEvent *e)
 		switch (e->button)
 		{
 			case Button1: // left mouse button
-				lclick_taskbar(e->x);
+				TIMED(STAT_TASKBAR, lclick_taskbar(e->x));
 				break;
 			case Button3: // right mouse button
-				rclick_taskbar(e->x);
+				TIMED(STAT_TASKBAR, rclick_taskbar(e->x));
 				break;
 			case Button4: // mouse wheel up
 				cycle_previous();
@@ -195,7 +460,7 @@ static void handle_button_press(XButtonEvent *e)
 		}
 		else if (e->button == Button3)
 		{
-			rclick_root();
+			TIMED(STAT_TASKBAR, rclick_root());
 		}
 	}
 }
@@ -220,11 +485,16 @@ static void handle_windowbar_click(XButtonEvent *e, Client *c)
 
 		in_box = 1;
 
-		draw_button(c, &text_gc, &depressed_gc, in_box_down);
+		draw_button(c, BUTTON_DEPRESSED, in_box_down);
 
 		do
 		{
 			XMaskEvent(dsply, MouseMask, &ev);
+			log_xevent(&ev);
+			if (ev.type == MotionNotify)
+			{
+				compress_motion(&ev, NULL);
+			}
 			in_box_up = box_clicked(c, ev.xbutton.x - (c->x + DEF_BORDERWIDTH));
 			win_ypos = (ev.xbutton.y - c->y) + BARHEIGHT();
 			if (ev.type == MotionNotify)
@@ -232,17 +502,17 @@ static void handle_windowbar_click(XButtonEvent *e, Client *c)
 				if ((win_ypos <= BARHEIGHT()) && (win_ypos >= DEF_BORDERWIDTH) && (in_box_up == in_box_down))
 				{
 					in_box = 1;
-					draw_button(c, &text_gc, &depressed_gc, in_box_down);
+					draw_button(c, BUTTON_DEPRESSED, in_box_down);
 				}
 				else
 				{
 					in_box = 0;
-					draw_button(c, &text_gc, &active_gc, in_box_down);
+					draw_button(c, BUTTON_ACTIVE, in_box_down);
 				}
 			}
 		}
 		while (ev.type != ButtonRelease);
-		draw_button(c, &text_gc, &active_gc, in_box_down);
+		draw_button(c, BUTTON_ACTIVE, in_box_down);
 
 		XUngrabServer(dsply);
 		ungrab();
@@ -294,18 +564,18 @@ static unsigned int box_clicked(Client *c, int x)
 	}
 }
 
-static void draw_button(Client *c, GC *detail_gc, GC *background_gc, unsigned int which_box)
+static void draw_button(Client *c, int state, unsigned int which_box)
 {
 	switch (which_box)
 	{
 		case 0:
-			draw_close_button(c, detail_gc, background_gc);
+			draw_close_button(c, state);
 			break;
 		case 1:
-			draw_toggledepth_button(c, detail_gc, background_gc);
+			draw_toggledepth_button(c, state);
 			break;
 		case 2:
-			draw_hide_button(c, detail_gc, background_gc);
+			draw_hide_button(c, state);
 			break;
 	}
 }
@@ -386,7 +656,7 @@ static void handle_configure_request(XConfigureRequestEvent *e)
 		//wc.stack_mode = e->detail;
 		XConfigureWindow(dsply, c->frame, e->value_mask, &wc);
 #ifdef SHAPE
-		if (e->value_mask & (CWWidth|CWHeight))
+		if ((e->value_mask & (CWWidth|CWHeight)) && !defer_work(c, DIRTY_SHAPE))
 		{
 			set_shape(c);
 		}
@@ -416,14 +686,37 @@ static void handle_configure_request(XConfigureRequestEvent *e)
 
 static void handle_map_request(XMapRequestEvent *e)
 {
+	unsigned long long start = get_time_ns();
 	Client *c = find_client(e->window, WINDOW);
 	if (c != NULL)
 	{
+		if (c->hidden)
+		{
+			c->map_requested = start;
+		}
 		unhide(c);
 	}
 	else
 	{
 		make_new_client(e->window);
+		c = find_client(e->window, WINDOW);
+		if (c != NULL && !c->hidden)
+		{
+			c->map_requested = start;
+		}
+	}
+}
+
+/* The other end of the map latency measurement: the frame we put
+ * around a client (or put back on screen) has been mapped. */
+
+static void handle_map_event(XMapEvent *e)
+{
+	Client *c = find_client(e->window, FRAME);
+	if (c != NULL && c->map_requested)
+	{
+		record_latency(STAT_MAP_LATENCY, c->map_requested);
+		c->map_requested = 0;
 	}
 }
 
@@ -485,9 +778,11 @@ static void handle_client_message(XClientMessageEvent *e)
 }
 
 /* All that we have cached is the name and the size hints, so we only
- * have to check for those here. A change in the name means we have to
- * immediately wipe out the old name and redraw; size hints only get
- * used when we need them. */
+ * have to check for those here. A change in the name only marks it
+ * stale and schedules a repaint of the titlebar and task button; the
+ * new name is fetched by update_title when they're painted, once
+ * however many times it changed in between. Size hints only get used
+ * when we need them. */
 
 static void handle_property_change(XPropertyEvent *e)
 {
@@ -499,17 +794,13 @@ static void handle_property_change(XPropertyEvent *e)
 		switch (e->atom)
 		{
 			case XA_WM_NAME:
-				if (c->name)
-				{
-					XFree(c->name);
-					c->name = NULL;
-				}
-				XFetchName(dsply, c->window, &c->name);
-				redraw(c);
-				redraw_taskbar();
+				// fetched by update_title when it's next painted
+				c->name_stale = True;
+				schedule_redraw(c);
+				schedule_taskbutton_redraw(c);
 				break;
 			case XA_WM_NORMAL_HINTS:
-				XGetWMNormalHints(dsply, c->window, c->size, &dummy);
+				ROUNDTRIP(XGetWMNormalHints(dsply, c->window, c->size, &dummy));
 				break;
 		}
 	}
@@ -534,7 +825,7 @@ static void handle_enter_event(XCrossingEvent *e)
 		if (showing_taskbar == 0)
 		{
 			showing_taskbar = 1;
-			redraw_taskbar();
+			schedule_taskbar_redraw();
 		}
 	}
 	else
@@ -545,7 +836,7 @@ static void handle_enter_event(XCrossingEvent *e)
 			if (showing_taskbar == 1)
 			{
 				showing_taskbar = 0;
-				redraw_taskbar();
+				schedule_taskbar_redraw();
 			}
 		}
 		else // no fullscreen client
@@ -553,7 +844,7 @@ static void handle_enter_event(XCrossingEvent *e)
 			if (showing_taskbar == 0)
 			{
 				showing_taskbar = 1;
-				redraw_taskbar();
+				schedule_taskbar_redraw();
 			}
 		}
 
@@ -593,17 +884,14 @@ static void handle_expose_event(XExposeEvent *e)
 {
 	if (e->window == taskbar)
 	{
-		if (e->count == 0)
-		{
-			redraw_taskbar();
-		}
+		present_taskbar(e->x, e->width);
 	}
 	else
 	{
 		Client *c = find_client(e->window, FRAME);
 		if (c != NULL && e->count == 0)
 		{
-			redraw(c);
+			schedule_redraw(c);
 		}
 	}
 }
@@ -612,47 +900,14 @@ static void handle_expose_event(XExposeEvent *e)
 static void handle_shape_change(XShapeEvent *e)
 {
 	Client *c = find_client(e->window, WINDOW);
-	if (c != NULL)
+	if (c == NULL || e->kind != ShapeBounding)
 	{
-		set_shape(c);
+		return; // the frame's shape only follows the client's bounding shape
 	}
-}
-#endif
-
-/* interruptibleXNextEvent() was originally taken from Blender's source code
- * and came with the following copyright notice: */
-
-/* Copyright (c) Mark J. Kilgard, 1994, 1995, 1996. */
-
-/* This program is freely distributable without licensing fees
- * and is provided without guarantee or warrantee expressed or
- * implied. This program is -not- in the public domain. */
-
-/* Unlike XNextEvent, if a signal arrives, interruptibleXNextEvent will
- * return zero. */
-
-static int interruptible_XNextEvent(XEvent *event)
-{
-	fd_set fds;
-	int rc;
-	int dsply_fd = ConnectionNumber(dsply);
-	for (;;)
+	shape_changed(c, e);
+	if (!defer_work(c, DIRTY_SHAPE))
 	{
-		if (XPending(dsply))
-		{
-			XNextEvent(dsply, event);
-			return 1;
-		}
-		FD_ZERO(&fds);
-		FD_SET(dsply_fd, &fds);
-		rc = select(dsply_fd + 1, &fds, NULL, NULL, NULL);
-		if (rc < 0)
-		{
-			if (errno == EINTR)
-			{
-				return 0;
-			}
-			return 1;
-		}
+		set_shape(c);
 	}
 }
+#endif
@@ -0,0 +1,289 @@
+/* WindowLab - an X11 window manager
+ * Copyright (c) 2001-2010 Nick Gravgaard
+ * me at nickgravgaard.com
+ * http://nickgravgaard.com/windowlab/
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include "windowlab.h"
+
+/* The main loop sleeps in epoll_wait on the X connection, a timerfd
+ * and any other file descriptors registered with watch_fd, and only
+ * hands back X events; everything else is dealt with here by calling
+ * the handler that was registered for it. Timers are kept in a list
+ * sorted by when they're due, and the timerfd is armed for the first
+ * one, so however many there are it costs one descriptor, and when
+ * there are none (and nothing else happens) we don't wake up at all. */
+
+#define MAX_EPOLL_EVENTS 16
+
+typedef struct Watch
+{
+	struct Watch *next;
+	int fd;
+	void (*handler)(int, void *);
+	void *data;
+} Watch;
+
+static int epoll_fd = -1, timer_fd = -1;
+static Watch x_watch, timer_watch;
+static Watch *watches = NULL, *dead_watches = NULL;
+static Timer *timers = NULL;
+static Timer *firing = NULL;
+static Bool firing_cancelled = False;
+
+static void add_to_epoll(Watch *w)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.events = EPOLLIN;
+	ev.data.ptr = w;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, w->fd, &ev) < 0)
+	{
+		err("can't watch file descriptor %d: %s", w->fd, strerror(errno));
+		exit(1);
+	}
+}
+
+void init_loop(void)
+{
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+	if (epoll_fd < 0 || timer_fd < 0)
+	{
+		err("can't set up the main loop: %s", strerror(errno));
+		exit(1);
+	}
+	x_watch.fd = ConnectionNumber(dsply);
+	add_to_epoll(&x_watch);
+	timer_watch.fd = timer_fd;
+	add_to_epoll(&timer_watch);
+}
+
+void watch_fd(int fd, void (*handler)(int, void *), void *data)
+{
+	Watch *w = (Watch *)malloc(sizeof *w);
+
+	w->fd = fd;
+	w->handler = handler;
+	w->data = data;
+	w->next = watches;
+	watches = w;
+	add_to_epoll(w);
+}
+
+/* The watch isn't freed until the events epoll_wait has already
+ * handed us are dealt with, as some of them may be for it. */
+
+void unwatch_fd(int fd)
+{
+	Watch **p, *w;
+
+	for (p = &watches; *p != NULL; p = &(*p)->next)
+	{
+		if ((*p)->fd == fd)
+		{
+			w = *p;
+			*p = w->next;
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+			w->handler = NULL;
+			w->next = dead_watches;
+			dead_watches = w;
+			return;
+		}
+	}
+}
+
+static void arm_timer_fd(void)
+{
+	struct itimerspec its;
+
+	memset(&its, 0, sizeof its); // all zero disarms it
+	if (timers != NULL)
+	{
+		its.it_value.tv_sec = timers->when / 1000000000ULL;
+		its.it_value.tv_nsec = timers->when % 1000000000ULL;
+		if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+		{
+			its.it_value.tv_nsec = 1;
+		}
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void insert_timer(Timer *t)
+{
+	Timer **p;
+
+	for (p = &timers; *p != NULL && (*p)->when <= t->when; p = &(*p)->next)
+	{
+		continue;
+	}
+	t->next = *p;
+	*p = t;
+}
+
+/* Call fire(data) after delay nanoseconds and then, if interval isn't
+ * 0, every interval nanoseconds until the timer is cancelled. A one
+ * shot timer is freed once it has fired, so cancel_timer mustn't be
+ * given it after that. */
+
+Timer *add_timer(unsigned long long delay, unsigned long long interval, void (*fire)(void *), void *data)
+{
+	Timer *t = (Timer *)malloc(sizeof *t);
+
+	t->when = get_time_ns() + delay;
+	t->interval = interval;
+	t->fire = fire;
+	t->data = data;
+	insert_timer(t);
+	if (timers == t)
+	{
+		arm_timer_fd();
+	}
+	return t;
+}
+
+void cancel_timer(Timer *t)
+{
+	Timer **p;
+
+	if (t == firing)
+	{
+		firing_cancelled = True;
+		return;
+	}
+	for (p = &timers; *p != NULL; p = &(*p)->next)
+	{
+		if (*p == t)
+		{
+			*p = t->next;
+			free(t);
+			arm_timer_fd();
+			return;
+		}
+	}
+}
+
+static void run_timers(void)
+{
+	unsigned long long now = get_time_ns();
+	uint64_t expirations;
+	Timer *t;
+
+	while (read(timer_fd, &expirations, sizeof expirations) > 0)
+	{
+		continue;
+	}
+	while (timers != NULL && timers->when <= now)
+	{
+		t = timers;
+		timers = t->next;
+		firing = t;
+		firing_cancelled = False;
+		t->fire(t->data);
+		firing = NULL;
+		if (t->interval != 0 && !firing_cancelled)
+		{
+			// don't try to catch up on ticks we slept through
+			t->when += t->interval;
+			if (t->when <= now)
+			{
+				t->when = now + t->interval;
+			}
+			insert_timer(t);
+		}
+		else
+		{
+			free(t);
+		}
+	}
+	arm_timer_fd();
+}
+
+/* Wait for the next X event, dealing with timers and other file
+ * descriptors until one arrives. Anything Xlib has already read off
+ * the connection is returned before we go near epoll_wait, but any
+ * timers that have come due are run first (and what they repaint is
+ * painted), as a steady stream of events would otherwise keep us from
+ * ever getting to epoll_wait to notice them. Before we sleep the
+ * requests made while handling the last batch of events are flushed
+ * and any repaints they scheduled are done. Returns 0 (with no event)
+ * if a signal interrupted the wait. */
+
+int next_xevent(XEvent *event)
+{
+	struct epoll_event evs[MAX_EPOLL_EVENTS];
+	Watch *w;
+	int n, i;
+
+	for (;;)
+	{
+		if (XPending(dsply))
+		{
+			if (timers != NULL && timers->when <= get_time_ns())
+			{
+				run_timers();
+				flush_redraws();
+			}
+			XNextEvent(dsply, event);
+			return 1;
+		}
+		// the batch is done, so paint whatever it changed before we sleep
+		handle_queued_errors();
+		flush_redraws();
+		XFlush(dsply);
+		if (XEventsQueued(dsply, QueuedAlready))
+		{
+			// a reply the repaints waited for brought events in with it
+			continue;
+		}
+		n = epoll_wait(epoll_fd, evs, MAX_EPOLL_EVENTS, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				return 0;
+			}
+			err("epoll_wait: %s", strerror(errno));
+			continue;
+		}
+		for (i = 0; i < n; i++)
+		{
+			w = (Watch *)evs[i].data.ptr;
+			if (w == &timer_watch)
+			{
+				run_timers();
+			}
+			else if (w != &x_watch && w->handler != NULL)
+			{
+				w->handler(w->fd, w->data);
+			}
+			// nothing to do for the X connection: XPending will read it
+		}
+		while (dead_watches != NULL)
+		{
+			w = dead_watches;
+			dead_watches = w->next;
+			free(w);
+		}
+	}
+}
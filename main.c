@@ -20,10 +20,14 @@
 
 #include <string.h>
 #include <signal.h>
+#include <fcntl.h>
 #include <X11/cursorfont.h>
 #include "windowlab.h"
 
 Display *dsply = NULL;
+#ifdef XCB
+xcb_connection_t *xconn = NULL;
+#endif
 Window root;
 int screen;
 XFontStruct *font = NULL;
@@ -38,10 +42,9 @@ Atom wm_state, wm_change_state, wm_protos, wm_delete, wm_cmapwins;
 #ifdef MWM_HINTS
 Atom mwm_hints;
 #endif
-Client *head_client = NULL, *focused_client = NULL, *topmost_client = NULL, *fullscreen_client = NULL;
+Client *head_client = NULL, *tail_client = NULL, *focused_client = NULL, *topmost_client = NULL, *fullscreen_client = NULL;
 unsigned int in_taskbar = 0; // actually, we don't know yet
 unsigned int showing_taskbar = 1;
-unsigned int focus_count = 0;
 Rect fs_prevdims;
 char *opt_font = DEF_FONT;
 char *opt_border = DEF_BORDER;
@@ -52,6 +55,10 @@ char *opt_menu = DEF_MENU;
 char *opt_selected = DEF_SELECTED;
 char *opt_empty = DEF_EMPTY;
 char *opt_display = NULL;
+char *opt_record = NULL;
+int opt_moverate = DEF_MOVERATE;
+int opt_configrate = DEF_CONFIGRATE;
+int opt_budget = 0;
 #ifdef SHAPE
 Bool shape;
 int shape_event;
@@ -64,7 +71,6 @@ static void setup_display(void);
 int main(int argc, char **argv)
 {
 	int i;
-	struct sigaction act;
 
 #define OPT_STR(name, variable)	 \
 	if (strcmp(argv[i], name) == 0 && i + 1 < argc) \
@@ -72,6 +78,12 @@ int main(int argc, char **argv)
 		variable = argv[++i]; \
 		continue; \
 	}
+#define OPT_INT(name, variable)	 \
+	if (strcmp(argv[i], name) == 0 && i + 1 < argc) \
+	{ \
+		variable = atoi(argv[++i]); \
+		continue; \
+	}
 
 	for (i = 1; i < argc; i++)
 	{
@@ -84,25 +96,34 @@ int main(int argc, char **argv)
 		OPT_STR("-selected", opt_selected)
 		OPT_STR("-empty", opt_empty)
 		OPT_STR("-display", opt_display)
+		OPT_STR("-record", opt_record)
+		OPT_INT("-moverate", opt_moverate)
+		OPT_INT("-configrate", opt_configrate)
+		if (strcmp(argv[i], "-budget") == 0)
+		{
+			opt_budget = 1;
+			continue;
+		}
 		if (strcmp(argv[i], "-about") == 0)
 		{
 			printf("WindowLab " VERSION " (" RELEASEDATE "), Copyright (c) 2001-2009 Nick Gravgaard\nWindowLab comes with ABSOLUTELY NO WARRANTY.\nThis is free software, and you are welcome to redistribute it\nunder certain conditions; view the LICENCE file for details.\n");
 			exit(0);
 		}
 		// shouldn't get here; must be a bad option
-		err("usage:\n  windowlab [options]\n\noptions are:\n  -font <font>\n  -border|-text|-active|-inactive|-menu|-selected|-empty <color>\n  -about\n  -display <display>");
+		err("usage:\n  windowlab [options]\n\noptions are:\n  -font <font>\n  -border|-text|-active|-inactive|-menu|-selected|-empty <color>\n  -moverate|-configrate <per second>\n  -budget\n  -record <file>\n  -about\n  -display <display>");
 		return 2;
 	}
 
-	act.sa_handler = sig_handler;
-	act.sa_flags = 0;
-	sigaction(SIGTERM, &act, NULL);
-	sigaction(SIGINT, &act, NULL);
-	sigaction(SIGHUP, &act, NULL);
-	sigaction(SIGCHLD, &act, NULL);
-
+	block_signals();
 	setup_display();
+	init_loop();
+	watch_signals();
+	if (opt_record != NULL)
+	{
+		open_recording(opt_record);
+	}
 	get_menuitems();
+	watch_menufiles();
 	make_taskbar();
 	scan_wins();
 	do_event_loop();
@@ -111,20 +132,17 @@ int main(int argc, char **argv)
 
 static void scan_wins(void)
 {
-	unsigned int nwins, i;
+	unsigned int nwins;
 	Window dummyw1, dummyw2, *wins;
-	XWindowAttributes attr;
 
-	XQueryTree(dsply, root, &dummyw1, &dummyw2, &wins, &nwins);
-	for (i = 0; i < nwins; i++)
+	if (ROUNDTRIP(XQueryTree(dsply, root, &dummyw1, &dummyw2, &wins, &nwins)))
 	{
-		XGetWindowAttributes(dsply, wins[i], &attr);
-		if (!attr.override_redirect && attr.map_state == IsViewable)
+		adopt_windows(wins, nwins);
+		if (wins != NULL)
 		{
-			make_new_client(wins[i]);
+			XFree(wins);
 		}
 	}
-	XFree(wins);
 }
 
 static void setup_display(void)
@@ -145,6 +163,11 @@ static void setup_display(void)
 		err("can't open display! check your DISPLAY variable.");
 		exit(1);
 	}
+	// the programs started from the menu shouldn't get our connection
+	fcntl(ConnectionNumber(dsply), F_SETFD, FD_CLOEXEC);
+#ifdef XCB
+	xconn = XGetXCBConnection(dsply);
+#endif
 
 	XSetErrorHandler(handle_xerror);
 	screen = DefaultScreen(dsply);
@@ -229,12 +252,13 @@ static void setup_display(void)
 
 	gv.foreground = text_col.pixel;
 	gv.line_width = 1;
+	gv.graphics_exposures = False; // text_gc also copies from our pixmaps, which never need NoExpose events
 
 #ifdef XFT
-	text_gc = XCreateGC(dsply, root, GCFunction|GCForeground, &gv);
+	text_gc = XCreateGC(dsply, root, GCFunction|GCForeground|GCGraphicsExposures, &gv);
 #else
 	gv.font = font->fid;
-	text_gc = XCreateGC(dsply, root, GCFunction|GCForeground|GCFont, &gv);
+	text_gc = XCreateGC(dsply, root, GCFunction|GCForeground|GCFont|GCGraphicsExposures, &gv);
 #endif
 
 	gv.foreground = active_col.pixel;
@@ -255,8 +279,12 @@ static void setup_display(void)
 	gv.foreground = empty_col.pixel;
 	empty_gc = XCreateGC(dsply, root, GCFunction|GCForeground, &gv);
 
+	make_button_pixmaps();
+
 	sattr.event_mask = ChildMask|ColormapChangeMask|ButtonMask;
 	XChangeWindowAttributes(dsply, root, CWEventMask, &sattr);
+	// find out now, rather than part way through scan_wins, if another wm has the root
+	ROUNDTRIP(XSync(dsply, False));
 
 	grab_keysym(root, MODIFIER, KEY_CYCLEPREV);
 	grab_keysym(root, MODIFIER, KEY_CYCLENEXT);
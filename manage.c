@@ -145,7 +145,7 @@ void toggle_fullscreen(Client *c)
 			fullscreen_client = c;
 			showing_taskbar = in_taskbar;
 		}
-		redraw_taskbar();
+		schedule_taskbar_redraw();
 	}
 }
 
@@ -158,7 +158,7 @@ void send_wm_delete(Client *c)
 	int i, n, found = 0;
 	Atom *protocols;
 
-	if (XGetWMProtocols(dsply, c->window, &protocols, &n))
+	if (ROUNDTRIP(XGetWMProtocols(dsply, c->window, &protocols, &n)))
 	{
 		for (i = 0; i < n; i++)
 		{
@@ -179,17 +179,31 @@ void send_wm_delete(Client *c)
 	}
 }
 
+/* The frame is moved at most opt_moverate times a second, however
+ * fast the motion events come in, and the client is only sent a
+ * synthetic ConfigureNotify opt_configrate times a second while the
+ * drag is going on, plus once at the end so it knows where it ended
+ * up. Motion that arrives between frame moves just updates where the
+ * next one will go. */
+
 void move(Client *c)
 {
 	XEvent ev;
 	int old_cx = c->x;
 	int old_cy = c->y;
-	int mousex, mousey, dw, dh;
+	int mousex, mousey, dw, dh, timeout;
 	Client *exposed_c;
 	Rect bounddims;
 	Window constraint_win;
 	XSetWindowAttributes pattr;
-
+	MotionStats drag = { 0, 0 };
+	unsigned long long now, next_move = 0, next_config = 0;
+	unsigned long long move_interval = (opt_moverate > 0) ? 1000000000ULL / opt_moverate : 0;
+	unsigned long long config_interval = (opt_configrate > 0) ? 1000000000ULL / opt_configrate : 0;
+	Bool move_pending = False, config_pending = False;
+	Mark mark;
+
+	start_mark(&mark);
 	dw = DisplayWidth(dsply, screen);
 	dh = DisplayHeight(dsply, screen);
 	get_mouse_position(&mousex, &mousey);
@@ -207,7 +221,7 @@ void move(Client *c)
 #endif
 	XMapWindow(dsply, constraint_win);
 
-	if (!(XGrabPointer(dsply, root, False, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, None, CurrentTime) == GrabSuccess))
+	if (!(ROUNDTRIP(XGrabPointer(dsply, root, False, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, None, CurrentTime)) == GrabSuccess))
 	{
 		XDestroyWindow(dsply, constraint_win);
 		return;
@@ -215,28 +229,69 @@ void move(Client *c)
 
 	do
 	{
-		XMaskEvent(dsply, ExposureMask|MouseMask, &ev);
+		flush_redraws();
+		timeout = -1;
+		if (move_pending)
+		{
+			now = get_time_ns();
+			timeout = (next_move > now) ? (int)((next_move - now + 999999) / 1000000) : 0;
+		}
+		if (!wait_for_event(ExposureMask|MouseMask, &ev, timeout))
+		{
+			ev.type = 0; // time for the next frame move
+		}
+		log_xevent(&ev);
 		switch (ev.type)
 		{
 			case Expose:
 				exposed_c = find_client(ev.xexpose.window, FRAME);
 				if (exposed_c != NULL)
 				{
-					redraw(exposed_c);
+					schedule_redraw(exposed_c);
 				}
 				break;
 			case MotionNotify:
+				compress_motion(&ev, &drag);
 				c->x = old_cx + (ev.xmotion.x - mousex);
 				c->y = old_cy + (ev.xmotion.y - mousey);
-				XMoveWindow(dsply, c->frame, c->x, c->y - BARHEIGHT());
-				send_config(c);
+				move_pending = True;
 				break;
 		}
+		if (move_pending)
+		{
+			now = get_time_ns();
+			if (now >= next_move)
+			{
+				XMoveWindow(dsply, c->frame, c->x, c->y - BARHEIGHT());
+				move_pending = False;
+				config_pending = True;
+				next_move = now + move_interval;
+				if (config_interval != 0 && now >= next_config)
+				{
+					send_config(c);
+					config_pending = False;
+					next_config = now + config_interval;
+				}
+			}
+		}
 	}
 	while (ev.type != ButtonRelease);
 
+	if (move_pending)
+	{
+		XMoveWindow(dsply, c->frame, c->x, c->y - BARHEIGHT());
+	}
+	if (config_pending || move_pending)
+	{
+		send_config(c);
+	}
 	ungrab();
 	XDestroyWindow(dsply, constraint_win);
+#ifdef DEBUG
+	fprintf(stderr, "move() : acted on %lu of %lu motion events\n", drag.handled, drag.received);
+#endif
+	mark.units = drag.received; // the budget for a drag depends on its length
+	record_handler(STAT_MOVE, &mark);
 }
 
 void resize(Client *c, int x, int y)
@@ -247,6 +302,7 @@ void resize(Client *c, int x, int y)
 	unsigned int dragging_outwards, dw, dh;
 	Window constraint_win, resize_win, resizebar_win;
 	XSetWindowAttributes pattr, resize_pattr, resizebar_pattr;
+	MotionStats drag = { 0, 0 };
 
 	if (x > c->x + BORDERWIDTH(c) && x < (c->x + c->width) - BORDERWIDTH(c) && y > (c->y - BARHEIGHT()) + BORDERWIDTH(c) && y < (c->y + c->height) - BORDERWIDTH(c))
 	{
@@ -270,7 +326,7 @@ void resize(Client *c, int x, int y)
 	constraint_win = XCreateWindow(dsply, root, bounddims.x, bounddims.y, bounddims.width, bounddims.height, 0, CopyFromParent, InputOnly, CopyFromParent, 0, &pattr);
 	XMapWindow(dsply, constraint_win);
 
-	if (!(XGrabPointer(dsply, root, False, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, resize_curs, CurrentTime) == GrabSuccess))
+	if (!(ROUNDTRIP(XGrabPointer(dsply, root, False, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, resize_curs, CurrentTime)) == GrabSuccess))
 	{
 		XDestroyWindow(dsply, constraint_win);
 		return;
@@ -308,24 +364,27 @@ void resize(Client *c, int x, int y)
 
 	do
 	{
+		flush_redraws();
 		XMaskEvent(dsply, ExposureMask|MouseMask, &ev);
+		log_xevent(&ev);
 		switch (ev.type)
 		{
 			case Expose:
 				if (ev.xexpose.window == resizebar_win)
 				{
-					write_titletext(c, resizebar_win);
+					write_titletext(c, resizebar_win, recalceddims.width);
 				}
 				else
 				{
 					exposed_c = find_client(ev.xexpose.window, FRAME);
 					if (exposed_c)
 					{
-						redraw(exposed_c);
+						schedule_redraw(exposed_c);
 					}
 				}
 				break;
 			case MotionNotify:
+				compress_motion(&ev, &drag);
 				{
 					unsigned int in_taskbar = 1, leftedge_changed = 0, rightedge_changed = 0, topedge_changed = 0, bottomedge_changed = 0;
 					int newwidth, newheight;
@@ -467,6 +526,9 @@ void resize(Client *c, int x, int y)
 
 	XMoveResizeWindow(dsply, c->frame, c->x, c->y - BARHEIGHT(), c->width, c->height + BARHEIGHT());
 	XResizeWindow(dsply, c->window, c->width, c->height);
+#ifdef SHAPE
+	set_shape(c);
+#endif
 
 	// unhide real window's frame
 	XMapWindow(dsply, c->frame);
@@ -483,6 +545,9 @@ void resize(Client *c, int x, int y)
 	
 	XDestroyWindow(dsply, resizebar_win);
 	XDestroyWindow(dsply, resize_win);
+#ifdef DEBUG
+	fprintf(stderr, "resize() : acted on %lu of %lu motion events\n", drag.handled, drag.received);
+#endif
 }
 
 static void limit_size(Client *c, Rect *newdims)
@@ -574,21 +639,27 @@ static int get_incsize(Client *c, unsigned int *x_ret, unsigned int *y_ret, Rect
 	return 0;
 }
 
-void write_titletext(Client *c, Window bar_win)
+void write_titletext(Client *c, Window bar_win, int width)
 {
+	TitleFit fit;
+
 #ifdef MWM_HINTS
 	if (!c->has_title)
 	{
 		return;
 	}
 #endif
+	update_title(c);
 	if (!c->trans && c->name != NULL)
 	{
+		// the resize bar only comes and goes, so its fit isn't worth keeping
+		fit.avail = FIT_UNKNOWN;
+		fit_title(c, &fit, width - (SPACE * 2));
 #ifdef XFT
 		(void) bar_win; // fixes a warning
-		XftDrawString8(c->xftdraw, &xft_detail, xftfont, SPACE, SPACE + xftfont->ascent, (unsigned char *)c->name, strlen(c->name));
+		draw_title(c, &fit, c->xftdraw, SPACE);
 #else
-		XDrawString(dsply, bar_win, text_gc, SPACE, SPACE + font->ascent, c->name, strlen(c->name));
+		draw_title(c, &fit, bar_win, SPACE);
 #endif
 	}
 }
@@ -18,12 +18,37 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
 #include "windowlab.h"
 
-// semaphor activated by SIGHUP
-int do_menuitems;
+/* The menu file is read once at startup, and again whenever it (or
+ * one of the files we'd fall back to) changes or we get a SIGHUP.
+ * A reload does its file I/O and parsing on a thread of its own, so
+ * a slow home directory can't hold up the event loop, and the thread
+ * tells us it's done through an eventfd. The new array is then
+ * measured (which needs the X connection, so it's done here) and
+ * swapped in between events, which is when nothing else is looking
+ * at it -- the menu itself is only ever shown from inside a single
+ * event handler. */
 
+#define MENURC_NAME "windowlab.menurc"
+#define MENU_RELOAD_DELAY 100000000ULL // wait for editors to finish saving
+
+static void exe_menurc_path(char *);
+static FILE *open_menufile(char *);
+static void read_menuitems(MenuItem **, unsigned int *);
+static void measure_menuitems(MenuItem *, unsigned int);
+static void free_menulist(MenuItem *, unsigned int);
 static int parseline(char *, char *, char *);
+static void *reload_thread_main(void *);
+static void handle_reloaded(int, void *);
+static void handle_inotify(int, void *);
+static void reload_timer_fired(void *);
+static void add_menurc_watch(char *);
+static void reload_in_place(void);
 
 MenuItem *menuitems = NULL;
 unsigned int num_menuitems;
@@ -31,64 +56,99 @@ unsigned int num_menuitems;
 XGlyphInfo extents;
 #endif
 
+static int inotify_fd = -1, reloaded_fd = -1;
+static int home_wd = -1, user_wd = -1;
+static pthread_t reload_thread;
+static Bool reloading = False, reload_again = False;
+static Timer *reload_timer = NULL;
+// written by the reload thread, and only read once it has been joined
+static MenuItem *new_menuitems = NULL;
+static unsigned int new_num_menuitems;
+
 void get_menuitems(void)
 {
-	unsigned int i, button_startx = 0;
-	FILE *menufile = NULL;
-	char menurcpath[PATH_MAX], *c;
-	extern int errno;
+	read_menuitems(&menuitems, &num_menuitems);
+	measure_menuitems(menuitems, num_menuitems);
+}
 
-	menuitems = (MenuItem *)malloc(MAX_MENUITEMS_SIZE);
-	if (menuitems == NULL)
+// <dir of the executable>/../etc/windowlab.menurc
+static void exe_menurc_path(char *menurcpath)
+{
+	ssize_t len;
+	char *c;
+
+	// get location of the executable
+	if ((len = readlink("/proc/self/exe", menurcpath, PATH_MAX - 1)) == -1)
 	{
-		err("Unable to allocate menu items array.");
-		return;
+		err("readlink() /proc/self/exe failed: %s\n", strerror(errno));
+		menurcpath[0] = '.';
+		menurcpath[1] = '\0';
 	}
-	memset(menuitems, 0, MAX_MENUITEMS_SIZE);
+	else
+	{
+		// insert null to end the file path properly
+		menurcpath[len] = '\0';
+	}
+	if ((c = strrchr(menurcpath, '/')) != NULL)
+	{
+		*c = '\0';
+	}
+	if ((c = strrchr(menurcpath, '/')) != NULL)
+	{
+		*c = '\0';
+	}
+	strncat(menurcpath, "/etc/" MENURC_NAME, PATH_MAX - strlen(menurcpath) - 1);
+}
 
-	snprintf(menurcpath, sizeof(menurcpath), "%s/.windowlab/windowlab.menurc", getenv("HOME"));
+static FILE *open_menufile(char *menurcpath)
+{
+	FILE *menufile;
+
+	snprintf(menurcpath, PATH_MAX, "%s/.windowlab/" MENURC_NAME, getenv("HOME"));
 #ifdef DEBUG
 	printf("trying to open: %s\n", menurcpath);
 #endif
-	if ((menufile = fopen(menurcpath, "r")) == NULL)
+	if ((menufile = fopen(menurcpath, "re")) == NULL)
 	{
-		ssize_t len;
-		// get location of the executable
-		if ((len = readlink("/proc/self/exe", menurcpath, PATH_MAX - 1)) == -1)
-		{
-			err("readlink() /proc/self/exe failed: %s\n", strerror(errno));
-			menurcpath[0] = '.';
-			menurcpath[1] = '\0';
-		}
-		else
-		{
-			// insert null to end the file path properly
-			menurcpath[len] = '\0';
-		}
-		if ((c = strrchr(menurcpath, '/')) != NULL)
-		{
-			*c = '\0';
-		}
-		if ((c = strrchr(menurcpath, '/')) != NULL)
-		{
-			*c = '\0';
-		}
-		strncat(menurcpath, "/etc/windowlab.menurc", PATH_MAX - strlen(menurcpath) - 1);
+		exe_menurc_path(menurcpath);
 #ifdef DEBUG
 		printf("trying to open: %s\n", menurcpath);
 #endif
-		if ((menufile = fopen(menurcpath, "r")) == NULL)
+		if ((menufile = fopen(menurcpath, "re")) == NULL)
 		{
 #ifdef DEBUG
 			printf("trying to open: %s\n", DEF_MENURC);
 #endif
-			menufile = fopen(DEF_MENURC, "r");
+			menufile = fopen(DEF_MENURC, "re");
 		}
 	}
+	return menufile;
+}
+
+/* This runs on the reload thread as well as the main one, so it
+ * mustn't touch the X connection or any of our globals. */
+
+static void read_menuitems(MenuItem **itemsp, unsigned int *countp)
+{
+	FILE *menufile = NULL;
+	char menurcpath[PATH_MAX];
+	MenuItem *items;
+	unsigned int count = 0;
+
+	*itemsp = NULL;
+	*countp = 0;
+	items = (MenuItem *)malloc(MAX_MENUITEMS_SIZE);
+	if (items == NULL)
+	{
+		err("Unable to allocate menu items array.");
+		return;
+	}
+	memset(items, 0, MAX_MENUITEMS_SIZE);
+
+	menufile = open_menufile(menurcpath);
 	if (menufile != NULL)
 	{
-		num_menuitems = 0;
-		while ((!feof(menufile)) && (!ferror(menufile)) && (num_menuitems < MAX_MENUITEMS))
+		while ((!feof(menufile)) && (!ferror(menufile)) && (count < MAX_MENUITEMS))
 		{
 			char menustr[STR_SIZE] = "";
 			fgets(menustr, STR_SIZE, menufile);
@@ -104,11 +164,11 @@ void get_menuitems(void)
 					char labelstr[STR_SIZE] = "", commandstr[STR_SIZE] = "";
 					if (parseline(pmenustr, labelstr, commandstr))
 					{
-						menuitems[num_menuitems].label = (char *)malloc(strlen(labelstr) + 1);
-						menuitems[num_menuitems].command = (char *)malloc(strlen(commandstr) + 1);
-						strcpy(menuitems[num_menuitems].label, labelstr);
-						strcpy(menuitems[num_menuitems].command, commandstr);
-						num_menuitems++;
+						items[count].label = (char *)malloc(strlen(labelstr) + 1);
+						items[count].command = (char *)malloc(strlen(commandstr) + 1);
+						strcpy(items[count].label, labelstr);
+						strcpy(items[count].command, commandstr);
+						count++;
 					}
 				}
 			}
@@ -119,33 +179,38 @@ void get_menuitems(void)
 	{
 		// one menu item - xterm
 		err("can't find ~/.windowlab/windowlab.menurc, %s or %s\n", menurcpath, DEF_MENURC);
-		menuitems[0].command = (char *)malloc(strlen(NO_MENU_COMMAND) + 1);
-		strcpy(menuitems[0].command, NO_MENU_COMMAND);
-		menuitems[0].label = (char *)malloc(strlen(NO_MENU_LABEL) + 1);
-		strcpy(menuitems[0].label, NO_MENU_LABEL);
-		num_menuitems = 1;
+		items[0].command = (char *)malloc(strlen(NO_MENU_COMMAND) + 1);
+		strcpy(items[0].command, NO_MENU_COMMAND);
+		items[0].label = (char *)malloc(strlen(NO_MENU_LABEL) + 1);
+		strcpy(items[0].label, NO_MENU_LABEL);
+		count = 1;
 	}
+	*itemsp = items;
+	*countp = count;
+}
 
-	for (i = 0; i < num_menuitems; i++)
+static void measure_menuitems(MenuItem *items, unsigned int count)
+{
+	unsigned int i, button_startx = 0;
+
+	for (i = 0; i < count; i++)
 	{
-		menuitems[i].x = button_startx;
+		items[i].x = button_startx;
 #ifdef XFT
-		XftTextExtents8(dsply, xftfont, (unsigned char *)menuitems[i].label, strlen(menuitems[i].label), &extents);
-		menuitems[i].width = extents.width + (SPACE * 4);
+		XftTextExtents8(dsply, xftfont, (unsigned char *)items[i].label, strlen(items[i].label), &extents);
+		items[i].width = extents.width + (SPACE * 4);
 #else
-		menuitems[i].width = XTextWidth(font, menuitems[i].label, strlen(menuitems[i].label)) + (SPACE * 4);
+		items[i].width = XTextWidth(font, items[i].label, strlen(items[i].label)) + (SPACE * 4);
 #endif
-		button_startx += menuitems[i].width + 1;
+		button_startx += items[i].width + 1;
 	}
-	// menu items have been built
-	do_menuitems = 0;
 }
 
 int parseline(char *menustr, char *labelstr, char *commandstr)
 {
 	int success = 0;
 	int menustrlen = strlen(menustr);
-	char *ptemp = NULL;
+	char *ptemp = NULL, *saveptr = NULL;
 	char *menustrcpy = (char *)malloc(menustrlen + 1);
 
 	if (menustrcpy == NULL)
@@ -154,12 +219,12 @@ int parseline(char *menustr, char *labelstr, char *commandstr)
 	}
 
 	strcpy(menustrcpy, menustr);
-	ptemp = strtok(menustrcpy, ":");
+	ptemp = strtok_r(menustrcpy, ":", &saveptr);
 
 	if (ptemp != NULL)
 	{
 		strcpy(labelstr, ptemp);
-		ptemp = strtok(NULL, "\n");
+		ptemp = strtok_r(NULL, "\n", &saveptr);
 		if (ptemp != NULL) // right of ':' is not empty
 		{
 			while (*ptemp == ' ' || *ptemp == '\t')
@@ -180,25 +245,235 @@ int parseline(char *menustr, char *labelstr, char *commandstr)
 	return success;
 }
 
-void free_menuitems(void)
+static void free_menulist(MenuItem *items, unsigned int count)
 {
 	unsigned int i;
-	if (menuitems != NULL)
+	if (items != NULL)
 	{
-		for (i = 0; i < num_menuitems; i++)
+		for (i = 0; i < count; i++)
 		{
-			if (menuitems[i].label != NULL)
+			if (items[i].label != NULL)
 			{
-				free(menuitems[i].label);
-				menuitems[i].label = NULL;
+				free(items[i].label);
+				items[i].label = NULL;
 			}
-			if (menuitems[i].command != NULL)
+			if (items[i].command != NULL)
 			{
-				free(menuitems[i].command);
-				menuitems[i].command = NULL;
+				free(items[i].command);
+				items[i].command = NULL;
 			}
 		}
-		free(menuitems);
-		menuitems = NULL;
+		free(items);
+	}
+}
+
+void free_menuitems(void)
+{
+	free_menulist(menuitems, num_menuitems);
+	menuitems = NULL;
+	num_menuitems = 0;
+}
+
+/* Start reading the menu file again. If a reload is already under
+ * way, another one is started when it finishes, as the file may have
+ * changed again after the thread read it. */
+
+void reload_menuitems(void)
+{
+	if (reloaded_fd < 0)
+	{
+		reload_in_place();
+		return;
+	}
+	if (reloading)
+	{
+		reload_again = True;
+		return;
+	}
+	if (pthread_create(&reload_thread, NULL, reload_thread_main, NULL) != 0)
+	{
+		err("can't start a thread to reload the menu; reloading it in place");
+		reload_in_place();
+		return;
+	}
+	reloading = True;
+}
+
+static void reload_in_place(void)
+{
+	free_menuitems();
+	get_menuitems();
+	schedule_taskbar_redraw();
+}
+
+static void *reload_thread_main(void *arg)
+{
+	uint64_t one = 1;
+
+	(void) arg; // fixes a warning
+	read_menuitems(&new_menuitems, &new_num_menuitems);
+	while (write(reloaded_fd, &one, sizeof one) < 0 && errno == EINTR)
+	{
+		continue;
 	}
+	return NULL;
+}
+
+static void handle_reloaded(int fd, void *data)
+{
+	uint64_t count;
+
+	(void) data; // fixes a warning
+	if (read(fd, &count, sizeof count) != sizeof count || !reloading)
+	{
+		return;
+	}
+	pthread_join(reload_thread, NULL);
+	reloading = False;
+	if (new_menuitems != NULL)
+	{
+		measure_menuitems(new_menuitems, new_num_menuitems);
+		free_menuitems();
+		menuitems = new_menuitems;
+		num_menuitems = new_num_menuitems;
+		new_menuitems = NULL;
+		schedule_taskbar_redraw();
+	}
+	if (reload_again)
+	{
+		reload_again = False;
+		reload_menuitems();
+	}
+}
+
+/* We watch the directories rather than the files, so we also see
+ * them being created, deleted, or replaced by an editor that saves
+ * by renaming a new copy over the old one. If ~/.windowlab doesn't
+ * exist yet we watch $HOME until it turns up. */
+
+void watch_menufiles(void)
+{
+	char path[PATH_MAX], *c;
+
+	reloaded_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+	if (reloaded_fd < 0)
+	{
+		err("eventfd(): %s; the menu will be reloaded in place", strerror(errno));
+		return;
+	}
+	watch_fd(reloaded_fd, handle_reloaded, NULL);
+
+	inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (inotify_fd < 0)
+	{
+		err("inotify_init1(): %s; send SIGHUP to reload the menu", strerror(errno));
+		return;
+	}
+	watch_fd(inotify_fd, handle_inotify, NULL);
+
+	snprintf(path, sizeof path, "%s/.windowlab", getenv("HOME"));
+	add_menurc_watch(path);
+	exe_menurc_path(path);
+	if ((c = strrchr(path, '/')) != NULL)
+	{
+		*c = '\0';
+		add_menurc_watch(path);
+	}
+	snprintf(path, sizeof path, "%s", DEF_MENURC);
+	if ((c = strrchr(path, '/')) != NULL)
+	{
+		*c = '\0';
+		add_menurc_watch(path);
+	}
+}
+
+static void add_menurc_watch(char *dir)
+{
+	char userdir[PATH_MAX];
+	int wd;
+
+	wd = inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR);
+	snprintf(userdir, sizeof userdir, "%s/.windowlab", getenv("HOME"));
+	if (strcmp(dir, userdir) != 0)
+	{
+		return;
+	}
+	if (wd >= 0)
+	{
+		user_wd = wd;
+		if (home_wd >= 0)
+		{
+			inotify_rm_watch(inotify_fd, home_wd);
+			home_wd = -1;
+		}
+	}
+	else if (home_wd < 0)
+	{
+		home_wd = inotify_add_watch(inotify_fd, getenv("HOME"), IN_CREATE|IN_MOVED_TO|IN_ONLYDIR);
+	}
+}
+
+static void handle_inotify(int fd, void *data)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	char path[PATH_MAX];
+	const char *def_name = strrchr(DEF_MENURC, '/') ? strrchr(DEF_MENURC, '/') + 1 : DEF_MENURC;
+	struct inotify_event *ev;
+	ssize_t len;
+	char *p;
+	Bool changed = False;
+
+	(void) data; // fixes a warning
+	while ((len = read(fd, buf, sizeof buf)) > 0)
+	{
+		for (p = buf; p < buf + len; p += sizeof(struct inotify_event) + ev->len)
+		{
+			ev = (struct inotify_event *)p;
+			if (ev->mask & IN_IGNORED)
+			{
+				if (ev->wd == user_wd)
+				{
+					// ~/.windowlab went away; watch for it coming back
+					user_wd = -1;
+					snprintf(path, sizeof path, "%s/.windowlab", getenv("HOME"));
+					add_menurc_watch(path);
+					changed = True;
+				}
+				continue;
+			}
+			if (ev->len == 0)
+			{
+				continue;
+			}
+			if (ev->wd == home_wd)
+			{
+				if (strcmp(ev->name, ".windowlab") == 0)
+				{
+					snprintf(path, sizeof path, "%s/.windowlab", getenv("HOME"));
+					add_menurc_watch(path);
+					changed = True;
+				}
+			}
+			else if (strcmp(ev->name, MENURC_NAME) == 0 || strcmp(ev->name, def_name) == 0)
+			{
+				changed = True;
+			}
+		}
+	}
+	// a save is often several events in a row, so wait for them to stop
+	if (changed)
+	{
+		if (reload_timer != NULL)
+		{
+			cancel_timer(reload_timer);
+		}
+		reload_timer = add_timer(MENU_RELOAD_DELAY, 0, reload_timer_fired, NULL);
+	}
+}
+
+static void reload_timer_fired(void *data)
+{
+	(void) data; // fixes a warning
+	reload_timer = NULL;
+	reload_menuitems();
 }
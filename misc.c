@@ -22,10 +22,22 @@
 #include <string.h>
 #include <unistd.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/signalfd.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include "windowlab.h"
 
+static void handle_signals(int, void *);
 static void quit_nicely(void);
+static Bool motion_before_button(Display *, XEvent *, XPointer);
+
+// running totals for compress_motion
+MotionStats motion_stats;
+
+// the signals read from our signalfd, and what was blocked before we blocked them
+static sigset_t handled_signals, orig_sigmask;
 
 void err(const char *fmt, ...)
 {
@@ -46,6 +58,7 @@ void fork_exec(char *cmd)
 	switch (pid)
 	{
   		case 0:
+			sigprocmask(SIG_SETMASK, &orig_sigmask, NULL);
 			setsid();
 			envshell = getenv("SHELL");
 			if (envshell == NULL)
@@ -72,66 +85,64 @@ void fork_exec(char *cmd)
 	}
 }
 
-void sig_handler(int signal)
-{
-	pid_t pid;
-	int status;
+/* The signals we care about are blocked from the start and read from
+ * a signalfd by the main loop, so whatever they ask for (quitting,
+ * reloading the menu, dumping stats) runs as ordinary code between
+ * events rather than in a signal handler, and never in the middle of
+ * a drag or while the menu is up. */
 
-	switch (signal)
-	{
-		case SIGINT:
-		case SIGTERM:
-			quit_nicely();
-			break;
-		case SIGHUP:
-			do_menuitems = 1;
-			break;
-		case SIGCHLD:
-			while ((pid = waitpid(-1, &status, WNOHANG)) != 0)
-			{
-				if ((pid == -1) && (errno != EINTR))
-				{
-					break;
-				}
-				else
-				{
-					continue;
-				}
-			}
-			break;
-	}
+void block_signals(void)
+{
+	sigemptyset(&handled_signals);
+	sigaddset(&handled_signals, SIGTERM);
+	sigaddset(&handled_signals, SIGINT);
+	sigaddset(&handled_signals, SIGHUP);
+	sigaddset(&handled_signals, SIGCHLD);
+	sigaddset(&handled_signals, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &handled_signals, &orig_sigmask);
 }
 
-int handle_xerror(Display *dsply, XErrorEvent *e)
+void watch_signals(void)
 {
-	Client *c = find_client(e->resourceid, WINDOW);
-
-	if (e->error_code == BadAccess && e->resourceid == root)
+	int fd = signalfd(-1, &handled_signals, SFD_NONBLOCK|SFD_CLOEXEC);
+	if (fd < 0)
 	{
-		err("root window unavailable (maybe another wm is running?)");
+		err("signalfd(): %s", strerror(errno));
 		exit(1);
 	}
-	else
-	{
-		char msg[255];
-		XGetErrorText(dsply, e->error_code, msg, sizeof msg);
-		err("X error (%#lx): %s", e->resourceid, msg);
-	}
-
-	if (c != NULL)
-	{
-		remove_client(c, WITHDRAW);
-	}
-	return 0;
+	watch_fd(fd, handle_signals, NULL);
 }
 
-/* Ick. Argh. You didn't see this function. */
-
-int ignore_xerror(Display *dsply, XErrorEvent *e)
+static void handle_signals(int fd, void *data)
 {
-	(void) dsply;
-	(void) e;
-	return 0;
+	struct signalfd_siginfo info;
+	int status;
+
+	(void) data; // fixes a warning
+	while (read(fd, &info, sizeof info) == sizeof info)
+	{
+		switch (info.ssi_signo)
+		{
+			case SIGINT:
+			case SIGTERM:
+				quit_nicely();
+				break;
+			case SIGHUP:
+				reload_menuitems();
+				break;
+			case SIGUSR1:
+				dump_stats();
+				flush_recording();
+				break;
+			case SIGCHLD:
+				// one SIGCHLD can stand for any number of children
+				while (waitpid(-1, &status, WNOHANG) > 0)
+				{
+					continue;
+				}
+				break;
+		}
+	}
 }
 
 /* Currently, only send_wm_delete uses this one... */
@@ -156,7 +167,109 @@ void get_mouse_position(int *x, int *y)
 	int win_x, win_y;
 	unsigned int mask;
 
-	XQueryPointer(dsply, root, &mouse_root, &mouse_win, x, y, &win_x, &win_y, &mask);
+	ROUNDTRIP(XQueryPointer(dsply, root, &mouse_root, &mouse_win, x, y, &win_x, &win_y, &mask));
+}
+
+/* High rate mice can queue motion events faster than we can act on
+ * them, which makes whatever is being dragged trail behind the
+ * pointer. The drag loops call this with the MotionNotify they've
+ * just taken off the queue and it's replaced with the newest motion
+ * already queued behind it, so only the latest position is acted
+ * on. The totals are kept both for the drag (if the caller wants
+ * them) and overall. */
+
+unsigned int compress_motion(XEvent *ev, MotionStats *drag)
+{
+	Bool blocked = False;
+	unsigned int skipped = 0;
+
+	while (XCheckIfEvent(dsply, ev, motion_before_button, (XPointer)&blocked))
+	{
+		log_xevent(ev);
+		skipped++;
+		blocked = False;
+	}
+	motion_stats.received += skipped + 1;
+	motion_stats.handled++;
+	if (drag != NULL)
+	{
+		drag->received += skipped + 1;
+		drag->handled++;
+	}
+	return skipped;
+}
+
+/* Only match motion that was queued before the next button or key
+ * event, so that the pointer position after a ButtonRelease is never
+ * applied before the release itself. */
+
+static Bool motion_before_button(Display *d, XEvent *e, XPointer arg)
+{
+	Bool *blocked = (Bool *)arg;
+
+	(void) d;
+	if (*blocked)
+	{
+		return False;
+	}
+	switch (e->type)
+	{
+		case MotionNotify:
+			return True;
+		case ButtonPress:
+		case ButtonRelease:
+		case KeyPress:
+		case KeyRelease:
+			*blocked = True;
+			break;
+	}
+	return False;
+}
+
+unsigned long long get_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Like XMaskEvent, but gives up after timeout milliseconds (a
+ * negative timeout waits forever). Returns 0 if it timed out. */
+
+int wait_for_event(long mask, XEvent *ev, int timeout)
+{
+	fd_set fds;
+	struct timeval tv;
+	unsigned long long now, deadline;
+	int dsply_fd = ConnectionNumber(dsply);
+
+	if (timeout < 0)
+	{
+		XMaskEvent(dsply, mask, ev);
+		return 1;
+	}
+	deadline = get_time_ns() + (unsigned long long)timeout * 1000000ULL;
+	for (;;)
+	{
+		if (XCheckMaskEvent(dsply, mask, ev))
+		{
+			return 1;
+		}
+		now = get_time_ns();
+		if (now >= deadline)
+		{
+			return 0;
+		}
+		tv.tv_sec = (deadline - now) / 1000000000ULL;
+		tv.tv_usec = ((deadline - now) % 1000000000ULL) / 1000;
+		FD_ZERO(&fds);
+		FD_SET(dsply_fd, &fds);
+		if (select(dsply_fd + 1, &fds, NULL, NULL, &tv) == 0)
+		{
+			return 0;
+		}
+	}
 }
 
 /* If this is the fullscreen client we don't take BARHEIGHT() into account
@@ -312,7 +425,7 @@ void show_event(XEvent e)
 
 static const char *show_state(Client *c)
 {
-	switch (get_wm_state(c))
+	switch (get_wm_state(c->window))
 	{
 		SHOW(WithdrawnState)
 		SHOW(NormalState)
@@ -404,5 +517,6 @@ static void quit_nicely(void)
 	XSetInputFocus(dsply, PointerRoot, RevertToNone, CurrentTime);
 
 	XCloseDisplay(dsply);
-	exit(0);
+	close_recording();
+	exit(over_budget ? 3 : 0);
 }
@@ -18,11 +18,52 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#include <X11/Xatom.h>
 #include "windowlab.h"
 
+/* Everything we need to know about a window before we can frame it.
+ * wm_state is the state the window should end up in: whatever it
+ * already has if it's viewable (we're restarting, or replacing
+ * another WM), otherwise its initial_state hint or NormalState. */
+
+typedef struct ClientInfo
+{
+	Window trans;
+	char *name;
+	int x, y, width, height;
+	Colormap cmap;
+	int map_state;
+	Bool override_redirect;
+	XSizeHints *size;
+	long wm_state;
+#ifdef MWM_HINTS
+	Bool has_title, has_border;
+#endif
+} ClientInfo;
+
+#ifdef XCB
+typedef struct InfoCookies
+{
+	xcb_get_window_attributes_cookie_t attr;
+	xcb_get_geometry_cookie_t geom;
+	xcb_get_property_cookie_t trans, name, normal_hints, hints, state;
+#ifdef MWM_HINTS
+	xcb_get_property_cookie_t mwm;
+#endif
+} InfoCookies;
+
+static void request_client_info(Window, InfoCookies *);
+static Bool collect_client_info(InfoCookies *, ClientInfo *);
+#endif
+static Bool get_client_info(Window, ClientInfo *);
+#ifndef XCB
+static void get_client_props(Window, XWindowAttributes *, ClientInfo *);
+#endif
+static void free_client_info(ClientInfo *);
+static void frame_client(Window, ClientInfo *);
 static void init_position(Client *);
 static void reparent(Client *);
-#ifdef MWM_HINTS
+#if defined(MWM_HINTS) && !defined(XCB)
 static PropMwmHints *get_mwm_hints(Window);
 #endif
 
@@ -31,95 +72,175 @@ static PropMwmHints *get_mwm_hints(Window);
  * client was already mapped but has IconicState set (for instance,
  * when we are the second window manager in a session). That's
  * because there's one for the reparent (which happens on all viewable
- * windows) and then another for the unmapping itself. */
+ * windows) and then another for the unmapping itself.
+ *
+ * All of the properties we look at are fetched up front by
+ * get_client_info; with XCB that costs one round trip rather than
+ * one per property. Nothing after that waits on the server.
+ *
+ * We don't grab the server, so the window can be destroyed while
+ * we're at this. If it is, the requests we make for it fail, and we
+ * ignore those errors: the DestroyNotify queued behind them has
+ * remove_client tidy up after us. */
 
 void make_new_client(Window w)
 {
-	Client *c, *p;
+	ClientInfo info;
+	Mark mark;
+
+	start_mark(&mark);
+	ignore_errors();
+	if (get_client_info(w, &info))
+	{
+		frame_client(w, &info);
+	}
+	heed_errors();
+
+	schedule_taskbar_redraw();
+	record_handler(STAT_MANAGE, &mark);
+}
+
+/* Take over every window that's already on screen when we start. As
+ * far as possible this is done as a single batch: with XCB all of the
+ * requests for every window go out before we wait for any of the
+ * replies, the server is grabbed once for the lot, and the taskbar
+ * is only scheduled to be drawn once rather than once per window. */
+
+void adopt_windows(Window *wins, unsigned int nwins)
+{
+	ClientInfo info;
+	unsigned int i;
+	Bool ok;
+#ifdef XCB
+	InfoCookies *ck = (InfoCookies *)malloc(nwins * sizeof *ck);
+#else
 	XWindowAttributes attr;
-	XWMHints *hints;
-#ifdef MWM_HINTS
-	PropMwmHints *mhints;
 #endif
-	long dummy;
 
-	c = (Client *)malloc(sizeof *c);
-	if (head_client == NULL)
+	XGrabServer(dsply);
+#ifdef XCB
+	if (ck != NULL)
 	{
-		head_client = c;
+		for (i = 0; i < nwins; i++)
+		{
+			request_client_info(wins[i], &ck[i]);
+		}
 	}
-	else
+#endif
+	for (i = 0; i < nwins; i++)
 	{
-		p = head_client;
-		while (p->next != NULL)
+#ifdef XCB
+		ok = (ck != NULL) ? collect_client_info(&ck[i], &info) : get_client_info(wins[i], &info);
+#else
+		// don't bother fetching properties for windows we won't manage
+		ok = ROUNDTRIP(XGetWindowAttributes(dsply, wins[i], &attr)) && !attr.override_redirect && attr.map_state == IsViewable;
+		if (ok)
 		{
-			p = p->next;
+			get_client_props(wins[i], &attr, &info);
+		}
+#endif
+		if (ok && !info.override_redirect && info.map_state == IsViewable)
+		{
+			frame_client(wins[i], &info);
+		}
+		else if (ok)
+		{
+			free_client_info(&info);
 		}
-		p->next = c;
 	}
-	c->next = NULL;
+	XUngrabServer(dsply);
+#ifdef XCB
+	free(ck);
+#endif
 
-	XGrabServer(dsply);
+	schedule_taskbar_redraw();
+}
 
-	XGetTransientForHint(dsply, w, &c->trans);
-	XFetchName(dsply, w, &c->name);
-	XGetWindowAttributes(dsply, w, &attr);
+static void free_client_info(ClientInfo *info)
+{
+	if (info->name != NULL)
+	{
+		XFree(info->name);
+	}
+	if (info->size != NULL)
+	{
+		XFree(info->size);
+	}
+}
+
+static void frame_client(Window w, ClientInfo *info)
+{
+	Client *c;
+
+	c = (Client *)malloc(sizeof *c);
+	c->prev = tail_client;
+	c->next = NULL;
+	if (tail_client != NULL)
+	{
+		tail_client->next = c;
+	}
+	else
+	{
+		head_client = c;
+	}
+	tail_client = c;
 
 	c->window = w;
+	c->trans = info->trans;
+	c->name = info->name;
+	c->name_stale = False;
+	memset(&c->bar_fit, 0, sizeof c->bar_fit);
+	memset(&c->button_fit, 0, sizeof c->button_fit);
+	invalidate_title(c);
 	c->ignore_unmap = 0;
 	c->hidden = 0;
 	c->was_hidden = 0;
+	c->focus_prev = NULL;
+	c->focus_next = NULL;
+	c->dirty = 0;
+	c->map_requested = 0;
+	c->tokens = FLOOD_BURST;
+	c->tokens_at = get_time_ns();
+	c->deferred = 0;
+	c->flood_timer = NULL;
+	memset(&c->flood, 0, sizeof c->flood);
 #ifdef SHAPE
+	c->shaped = False;
 	c->has_been_shaped = 0;
+	c->shape_width = -1;
+	c->shape_height = -1;
 #endif
-	c->x = attr.x;
-	c->y = attr.y;
-	c->width = attr.width;
-	c->height = attr.height;
-	c->cmap = attr.colormap;
-	c->size = XAllocSizeHints();
-	XGetWMNormalHints(dsply, c->window, c->size, &dummy);
+	c->x = info->x;
+	c->y = info->y;
+	c->width = info->width;
+	c->height = info->height;
+	c->cmap = info->cmap;
+	c->size = info->size;
 #ifdef MWM_HINTS
-	c->has_title = 1;
-	c->has_border = 1;
-
-	if ((mhints = get_mwm_hints(c->window)))
-	{
-		if (mhints->flags & MWM_HINTS_DECORATIONS && !(mhints->decorations & MWM_DECOR_ALL))
-		{
-			c->has_title = mhints->decorations & MWM_DECOR_TITLE;
-			c->has_border = mhints->decorations & MWM_DECOR_BORDER;
-		}
-		XFree(mhints);
-	}
+	c->has_title = info->has_title;
+	c->has_border = info->has_border;
 #endif
 
 	// XReparentWindow seems to try an XUnmapWindow, regardless of whether the reparented window is mapped or not
 	c->ignore_unmap++;
-	
-	if (attr.map_state != IsViewable)
+
+	if (info->map_state != IsViewable)
 	{
 		init_position(c);
-		set_wm_state(c, NormalState);
-		if ((hints = XGetWMHints(dsply, w)))
-		{
-			if (hints->flags & StateHint)
-			{
-				set_wm_state(c, hints->initial_state);
-			}
-			XFree(hints);
-		}
+		set_wm_state(c, info->wm_state);
 	}
 
 	fix_position(c);
 	gravitate(c, APPLY_GRAVITY);
 	reparent(c);
+	index_client(c);
+	invalidate_taskbar_layout();
 
 #ifdef XFT
 	c->xftdraw = XftDrawCreate(dsply, (Drawable) c->frame, DefaultVisual(dsply, DefaultScreen(dsply)), DefaultColormap(dsply, DefaultScreen(dsply)));
 #endif
 
-	if (get_wm_state(c) != IconicState)
+	if (info->wm_state != IconicState)
 	{
 		XMapWindow(dsply, c->window);
 		XMapRaised(dsply, c->frame);
@@ -129,7 +250,7 @@ void make_new_client(Window w)
 	else
 	{
 		c->hidden = 1;
-		if(attr.map_state == IsViewable)
+		if (info->map_state == IsViewable)
 		{
 			c->ignore_unmap++;
 			XUnmapWindow(dsply, c->window);
@@ -142,17 +263,260 @@ void make_new_client(Window w)
 		check_focus(c);
 		focused_client = c;
 	}
+}
 
-	XSync(dsply, False);
-	XUngrabServer(dsply);
+#ifdef XCB
+
+/* Send every request get_client_info needs without waiting for any
+ * of the replies. */
 
-	redraw_taskbar();
+static void request_client_info(Window w, InfoCookies *ck)
+{
+	ck->attr = xcb_get_window_attributes(xconn, w);
+	ck->geom = xcb_get_geometry(xconn, w);
+	ck->trans = xcb_get_property(xconn, 0, w, XA_WM_TRANSIENT_FOR, XA_WINDOW, 0, 1);
+	ck->name = xcb_get_property(xconn, 0, w, XA_WM_NAME, XA_STRING, 0, title_fetch_length(0)); // the geometry isn't back yet
+	ck->normal_hints = xcb_get_property(xconn, 0, w, XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, 0, 18);
+	ck->hints = xcb_get_property(xconn, 0, w, XA_WM_HINTS, XA_WM_HINTS, 0, 9);
+	ck->state = xcb_get_property(xconn, 0, w, wm_state, wm_state, 0, 2);
+#ifdef MWM_HINTS
+	ck->mwm = xcb_get_property(xconn, 0, w, mwm_hints, mwm_hints, 0, 20);
+#endif
 }
 
+/* Returns the property's 32 bit items if it has the type we asked
+ * for and at least min_items of them, NULL otherwise. */
+
+static CARD32 *prop_items(xcb_get_property_reply_t *prop, xcb_atom_t type, int min_items)
+{
+	if (prop != NULL && prop->type == type && prop->format == 32 && (int)prop->value_len >= min_items)
+	{
+		return (CARD32 *)xcb_get_property_value(prop);
+	}
+	return NULL;
+}
+
+/* Pick up the replies to request_client_info, decoding the
+ * properties the same way Xlib's XFetchName, XGetTransientForHint,
+ * XGetWMNormalHints and XGetWMHints would. Every reply is collected
+ * even if the window has gone away, so none are left queued. */
+
+static Bool collect_client_info(InfoCookies *ck, ClientInfo *info)
+{
+	xcb_get_window_attributes_reply_t *attr;
+	xcb_get_geometry_reply_t *geom;
+	xcb_get_property_reply_t *prop;
+	xcb_generic_error_t *e = NULL;
+	CARD32 *data;
+	long initial_state = NormalState;
+	Bool ok;
+
+	// the rest of the replies come in behind this one
+	attr = ROUNDTRIP(xcb_get_window_attributes_reply(xconn, ck->attr, &e));
+	free(e);
+	e = NULL;
+	geom = xcb_get_geometry_reply(xconn, ck->geom, &e);
+	free(e);
+	e = NULL;
+	ok = (attr != NULL && geom != NULL);
+	if (ok)
+	{
+		info->x = geom->x;
+		info->y = geom->y;
+		info->width = geom->width;
+		info->height = geom->height;
+		info->cmap = attr->colormap;
+		info->map_state = attr->map_state;
+		info->override_redirect = attr->override_redirect;
+	}
+	free(attr);
+	free(geom);
+
+	info->trans = None;
+	prop = xcb_get_property_reply(xconn, ck->trans, &e);
+	if ((data = prop_items(prop, XA_WINDOW, 1)) != NULL)
+	{
+		info->trans = data[0];
+	}
+	free(prop);
+	free(e);
+	e = NULL;
+
+	info->name = NULL;
+	prop = xcb_get_property_reply(xconn, ck->name, &e);
+	if (ok && prop != NULL && prop->type == XA_STRING && prop->format == 8)
+	{
+		int len = xcb_get_property_value_length(prop);
+		info->name = (char *)malloc(len + 1);
+		if (info->name != NULL)
+		{
+			memcpy(info->name, xcb_get_property_value(prop), len);
+			info->name[len] = '\0';
+		}
+	}
+	free(prop);
+	free(e);
+	e = NULL;
+
+	info->size = ok ? XAllocSizeHints() : NULL;
+	prop = xcb_get_property_reply(xconn, ck->normal_hints, &e);
+	if (info->size != NULL && (data = prop_items(prop, XA_WM_SIZE_HINTS, 15)) != NULL)
+	{
+		info->size->flags = data[0] & (USPosition|USSize|PAllHints);
+		info->size->x = (INT32)data[1];
+		info->size->y = (INT32)data[2];
+		info->size->width = (INT32)data[3];
+		info->size->height = (INT32)data[4];
+		info->size->min_width = (INT32)data[5];
+		info->size->min_height = (INT32)data[6];
+		info->size->max_width = (INT32)data[7];
+		info->size->max_height = (INT32)data[8];
+		info->size->width_inc = (INT32)data[9];
+		info->size->height_inc = (INT32)data[10];
+		info->size->min_aspect.x = (INT32)data[11];
+		info->size->min_aspect.y = (INT32)data[12];
+		info->size->max_aspect.x = (INT32)data[13];
+		info->size->max_aspect.y = (INT32)data[14];
+		if (prop->value_len >= 18)
+		{
+			info->size->base_width = (INT32)data[15];
+			info->size->base_height = (INT32)data[16];
+			info->size->win_gravity = (INT32)data[17];
+			info->size->flags |= data[0] & (PBaseSize|PWinGravity);
+		}
+	}
+	free(prop);
+	free(e);
+	e = NULL;
+
+	prop = xcb_get_property_reply(xconn, ck->hints, &e);
+	if ((data = prop_items(prop, XA_WM_HINTS, 8)) != NULL && (data[0] & StateHint))
+	{
+		initial_state = (INT32)data[2];
+	}
+	free(prop);
+	free(e);
+	e = NULL;
+
+	info->wm_state = WithdrawnState;
+	prop = xcb_get_property_reply(xconn, ck->state, &e);
+	if ((data = prop_items(prop, wm_state, 1)) != NULL)
+	{
+		info->wm_state = (INT32)data[0];
+	}
+	free(prop);
+	free(e);
+	e = NULL;
+	if (ok && info->map_state != IsViewable)
+	{
+		info->wm_state = initial_state;
+	}
+
+#ifdef MWM_HINTS
+	info->has_title = 1;
+	info->has_border = 1;
+	prop = xcb_get_property_reply(xconn, ck->mwm, &e);
+	if ((data = prop_items(prop, mwm_hints, PROP_MWM_HINTS_ELEMENTS)) != NULL)
+	{
+		if (data[0] & MWM_HINTS_DECORATIONS && !(data[2] & MWM_DECOR_ALL))
+		{
+			info->has_title = data[2] & MWM_DECOR_TITLE;
+			info->has_border = data[2] & MWM_DECOR_BORDER;
+		}
+	}
+	free(prop);
+	free(e);
+#endif
+
+	return ok;
+}
+
+static Bool get_client_info(Window w, ClientInfo *info)
+{
+	InfoCookies ck;
+
+	request_client_info(w, &ck);
+	return collect_client_info(&ck, info);
+}
+
+#else
+
+/* Without XCB each of these is a separate round trip. */
+
+static Bool get_client_info(Window w, ClientInfo *info)
+{
+	XWindowAttributes attr;
+
+	if (!ROUNDTRIP(XGetWindowAttributes(dsply, w, &attr)))
+	{
+		return False;
+	}
+	get_client_props(w, &attr, info);
+	return True;
+}
+
+/* The rest of get_client_info, for when the attributes are already to
+ * hand (adopt_windows needs them first, to pick which windows to
+ * manage). */
+
+static void get_client_props(Window w, XWindowAttributes *attr, ClientInfo *info)
+{
+	XWMHints *hints;
+#ifdef MWM_HINTS
+	PropMwmHints *mhints;
+#endif
+	long dummy;
+
+	info->x = attr->x;
+	info->y = attr->y;
+	info->width = attr->width;
+	info->height = attr->height;
+	info->cmap = attr->colormap;
+	info->map_state = attr->map_state;
+	info->override_redirect = attr->override_redirect;
+
+	ROUNDTRIP(XGetTransientForHint(dsply, w, &info->trans));
+	info->name = fetch_title(w, info->width);
+	info->size = XAllocSizeHints();
+	ROUNDTRIP(XGetWMNormalHints(dsply, w, info->size, &dummy));
+#ifdef MWM_HINTS
+	info->has_title = 1;
+	info->has_border = 1;
+
+	if ((mhints = get_mwm_hints(w)))
+	{
+		if (mhints->flags & MWM_HINTS_DECORATIONS && !(mhints->decorations & MWM_DECOR_ALL))
+		{
+			info->has_title = mhints->decorations & MWM_DECOR_TITLE;
+			info->has_border = mhints->decorations & MWM_DECOR_BORDER;
+		}
+		XFree(mhints);
+	}
+#endif
+
+	if (attr->map_state != IsViewable)
+	{
+		info->wm_state = NormalState;
+		if ((hints = ROUNDTRIP(XGetWMHints(dsply, w))))
+		{
+			if (hints->flags & StateHint)
+			{
+				info->wm_state = hints->initial_state;
+			}
+			XFree(hints);
+		}
+	}
+	else
+	{
+		info->wm_state = get_wm_state(w);
+	}
+}
+#endif
+
 /* This one does *not* free the data coming back from Xlib; it just
  * sends back the pointer to what was allocated. */
 
-#ifdef MWM_HINTS
+#if defined(MWM_HINTS) && !defined(XCB)
 static PropMwmHints *get_mwm_hints(Window w)
 {
 	Atom real_type;
@@ -160,7 +524,7 @@ static PropMwmHints *get_mwm_hints(Window w)
 	unsigned long items_read, items_left;
 	unsigned char *data;
 
-	if (XGetWindowProperty(dsply, w, mwm_hints, 0L, 20L, False, mwm_hints, &real_type, &real_format, &items_read, &items_left, &data) == Success && items_read >= PROP_MWM_HINTS_ELEMENTS)
+	if (ROUNDTRIP(XGetWindowProperty(dsply, w, mwm_hints, 0L, 20L, False, mwm_hints, &real_type, &real_format, &items_read, &items_left, &data)) == Success && items_read >= PROP_MWM_HINTS_ELEMENTS)
 	{
 		return (PropMwmHints *)data;
 	}
@@ -223,6 +587,7 @@ static void reparent(Client *c)
 	if (shape)
 	{
 		XShapeSelectInput(dsply, c->window, ShapeNotifyMask);
+		query_shape(c);
 		set_shape(c);
 	}
 #endif
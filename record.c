@@ -0,0 +1,196 @@
+/* WindowLab - an X11 window manager
+ * Copyright (c) 2001-2010 Nick Gravgaard
+ * me at nickgravgaard.com
+ * http://nickgravgaard.com/windowlab/
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include <X11/Xatom.h>
+#include "windowlab.h"
+#include "record.h"
+
+/* With -record, every event that says something about what the user
+ * or the clients did is appended to a file (see record.h for what's
+ * kept), so that a session can be played back later with
+ * tools/replay. The events are logged from the main loop and from the
+ * loops that run while something is being dragged, before they're
+ * handled. When we aren't recording this costs one test per event.
+ *
+ * A couple of things the events don't tell us (the geometry of a
+ * window asking to be mapped, and the length of a new title) cost an
+ * extra round trip each while recording. */
+
+static FILE *recording = NULL;
+static unsigned long long last_logged;
+
+void open_recording(char *filename)
+{
+	RecordHeader header;
+
+	recording = fopen(filename, "wbe"); // not inherited by the programs we run
+	if (recording == NULL)
+	{
+		err("can't open '%s' to record to", filename);
+		exit(1);
+	}
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, RECORD_MAGIC, sizeof RECORD_MAGIC);
+	header.version = RECORD_VERSION;
+	header.byte_order = RECORD_BYTE_ORDER;
+	header.screen_width = DisplayWidth(dsply, screen);
+	header.screen_height = DisplayHeight(dsply, screen);
+	fwrite(&header, sizeof header, 1, recording);
+	last_logged = get_time_ns();
+}
+
+static uint32_t client_window(Window w)
+{
+	Client *c = find_client(w, FRAME);
+	if (c == NULL)
+	{
+		c = find_client(w, WINDOW);
+	}
+	return (c != NULL) ? c->window : 0;
+}
+
+void log_xevent(XEvent *ev)
+{
+	RecordedEvent r;
+	Client *c;
+	Window dummyw;
+	unsigned int width, height, dummyui;
+	int x, y, dummyi;
+	Atom real_type;
+	unsigned long items_read, items_left;
+	unsigned char *data;
+	unsigned long long delta;
+
+	if (recording == NULL)
+	{
+		return;
+	}
+	memset(&r, 0, sizeof r);
+	r.type = ev->type;
+	switch (ev->type)
+	{
+		case KeyPress:
+		case KeyRelease:
+			r.detail = ev->xkey.keycode;
+			r.state = ev->xkey.state;
+			r.window = client_window(ev->xkey.window);
+			break;
+		case ButtonPress:
+		case ButtonRelease:
+			r.detail = ev->xbutton.button;
+			r.state = ev->xbutton.state;
+			r.window = client_window(ev->xbutton.window);
+			r.x = ev->xbutton.x_root;
+			r.y = ev->xbutton.y_root;
+			break;
+		case MotionNotify:
+			r.x = ev->xmotion.x_root;
+			r.y = ev->xmotion.y_root;
+			break;
+		case EnterNotify:
+			r.window = client_window(ev->xcrossing.window);
+			r.x = ev->xcrossing.x_root;
+			r.y = ev->xcrossing.y_root;
+			break;
+		case MapRequest:
+			r.window = ev->xmaprequest.window;
+			if (ROUNDTRIP(XGetGeometry(dsply, ev->xmaprequest.window, &dummyw, &x, &y, &width, &height, &dummyui, &dummyui)))
+			{
+				r.x = x;
+				r.y = y;
+				r.width = width;
+				r.height = height;
+			}
+			break;
+		case ConfigureRequest:
+			r.window = ev->xconfigurerequest.window;
+			r.x = ev->xconfigurerequest.x;
+			r.y = ev->xconfigurerequest.y;
+			r.width = ev->xconfigurerequest.width;
+			r.height = ev->xconfigurerequest.height;
+			r.detail = ev->xconfigurerequest.detail;
+			r.data = ev->xconfigurerequest.value_mask;
+			break;
+		case PropertyNotify:
+			if (find_client(ev->xproperty.window, WINDOW) == NULL)
+			{
+				return;
+			}
+			r.window = ev->xproperty.window;
+			r.data = (ev->xproperty.atom <= XA_LAST_PREDEFINED) ? ev->xproperty.atom : 0;
+			if (ev->xproperty.atom == XA_WM_NAME && ROUNDTRIP(XGetWindowProperty(dsply, ev->xproperty.window, XA_WM_NAME, 0L, 0L, False, AnyPropertyType, &real_type, &dummyi, &items_read, &items_left, &data)) == Success)
+			{
+				r.width = (items_left > 0xffff) ? 0xffff : items_left;
+				if (data != NULL)
+				{
+					XFree(data);
+				}
+			}
+			break;
+		case ClientMessage:
+			if (ev->xclient.message_type != wm_change_state || ev->xclient.format != 32)
+			{
+				return;
+			}
+			r.window = ev->xclient.window;
+			r.data = ev->xclient.data.l[0];
+			break;
+		case UnmapNotify:
+			// leave out the ones we caused
+			c = find_client(ev->xunmap.window, WINDOW);
+			if (c == NULL || c->ignore_unmap > 0)
+			{
+				return;
+			}
+			r.window = ev->xunmap.window;
+			break;
+		case DestroyNotify:
+			if (find_client(ev->xdestroywindow.window, WINDOW) == NULL)
+			{
+				return;
+			}
+			r.window = ev->xdestroywindow.window;
+			break;
+		default:
+			return;
+	}
+	delta = (get_time_ns() - last_logged) / 1000ULL;
+	r.delta_us = (delta > 0xffffffffULL) ? 0xffffffff : delta;
+	last_logged += r.delta_us * 1000ULL;
+	fwrite(&r, sizeof r, 1, recording);
+}
+
+void flush_recording(void)
+{
+	if (recording != NULL)
+	{
+		fflush(recording);
+	}
+}
+
+void close_recording(void)
+{
+	if (recording != NULL)
+	{
+		fclose(recording);
+		recording = NULL;
+	}
+}
@@ -0,0 +1,76 @@
+/* WindowLab - an X11 window manager
+ * Copyright (c) 2001-2010 Nick Gravgaard
+ * me at nickgravgaard.com
+ * http://nickgravgaard.com/windowlab/
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/* The format written by -record and read by tools/replay. A recording
+ * is a RecordHeader followed by one RecordedEvent for every event we
+ * were sent that says something about what the user or the clients
+ * did (events that we caused ourselves, like Expose or MapNotify, are
+ * left out, as a replay will cause them again). Everything is in the
+ * byte order of the machine that made the recording; byte_order lets
+ * a reader tell. */
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <stdint.h>
+
+#define RECORD_MAGIC "WLREC\n"
+#define RECORD_VERSION 1
+#define RECORD_BYTE_ORDER 0x01020304
+
+typedef struct RecordHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint16_t screen_width, screen_height;
+	uint32_t reserved;
+} RecordHeader;
+
+/* window is the client window the event was about, as the recording
+ * saw it, or 0 for events on the root window or the taskbar. The other
+ * fields depend on the type:
+ *
+ * KeyPress, KeyRelease: detail is the keycode, state the modifiers
+ * ButtonPress, ButtonRelease: detail is the button, state the
+ *     modifiers, x and y the pointer position on the root window
+ * MotionNotify, EnterNotify: x and y are the root pointer position
+ * MapRequest: x, y, width and height are the window's geometry
+ * ConfigureRequest: x, y, width and height as asked for, data the
+ *     value_mask and detail the stacking mode
+ * PropertyNotify: data is the atom, if it's a predefined one (0 if
+ *     not), and width the new length of WM_NAME
+ * ClientMessage: only WM_CHANGE_STATE is kept; data is the state
+ * UnmapNotify, DestroyNotify: nothing more */
+
+typedef struct RecordedEvent
+{
+	uint32_t delta_us; // since the previous event
+	uint8_t type;
+	uint8_t detail;
+	uint16_t state;
+	uint32_t window;
+	int16_t x, y;
+	uint16_t width, height;
+	uint32_t data;
+} RecordedEvent;
+
+#endif /* RECORD_H */
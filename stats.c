@@ -0,0 +1,311 @@
+/* WindowLab - an X11 window manager
+ * Copyright (c) 2001-2010 Nick Gravgaard
+ * me at nickgravgaard.com
+ * http://nickgravgaard.com/windowlab/
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include "windowlab.h"
+
+/* Latency histograms, kept all the time and dumped (along with the
+ * motion and paint counters) to stderr on SIGUSR1. There's one for
+ * each X event type, timing everything done in response to it, and
+ * one for each of the handlers listed in windowlab.h, which may run
+ * for more than one kind of event. Bucket i counts the times that
+ * took from 2^i up to 2^(i+1) nanoseconds, so recording one is a
+ * handful of instructions on top of the two clock reads.
+ *
+ * Each histogram also adds up the requests sent (from Xlib's sequence
+ * numbers) and the round trips made (calls wrapped in ROUNDTRIP) while
+ * it was being timed. Round trips are also counted by the file they
+ * were made from, which is as close to a subsystem as we get. */
+
+static Histogram event_hist[LASTEvent + 1]; // the last one is for extension events, e.g. ShapeNotify
+static Histogram handler_hist[NUM_HANDLERS];
+
+static unsigned long roundtrips = 0;
+
+#define MAX_SUBSYSTEMS 16
+
+static struct
+{
+	const char *name;
+	unsigned long roundtrips;
+} subsystems[MAX_SUBSYSTEMS];
+static int num_subsystems = 0;
+
+/* With -budget, every call of a handler listed here is checked against
+ * the number of requests and round trips it's allowed, and going over
+ * is reported and makes us exit with status 3 when we're told to quit.
+ * Only a handler's own requests count: any it makes by calling another
+ * timed handler (manage and unmanage can both call focus, and move
+ * repaints what it uncovers) are checked against that one's budget. A
+ * handler that sets Mark.units (move, with the motion events in the
+ * drag) is also allowed units * per_unit / 100 more requests.
+ *
+ * The numbers are the most each path can make, counted through the
+ * code with shape, XCB, MWM hints and Xft all built in:
+ *
+ *   manage: the attributes (2 requests), transient, name, normal
+ *     hints, MWM hints and the hints (or WM_STATE, for a window
+ *     that's already viewable), plus a pointer query to place the
+ *     window. XCB asks for both the hints and WM_STATE. Then WM_STATE, the
+ *     frame, shape input, extents and combine (3), save set, input
+ *     mask, border, resize, reparent, ConfigureNotify, and mapping
+ *     the window and raising and mapping the frame (3): 25 requests.
+ *     Without XCB each fetch is a round trip, so 8 with the extents.
+ *   unmanage: WM_STATE (or map), reparent, border, save set, destroy
+ *     the frame, and freeing the Xft draw's picture and GC: 7.
+ *   focus: set the input focus and install the colormap: 2.
+ *   move: a pointer query and a grab (the round trips), the
+ *     constraint window's create, map and destroy, the ungrab, and a
+ *     last frame move and ConfigureNotify: 8, plus at most a frame
+ *     move and a ConfigureNotify for each motion event.
+ *
+ * These want updating whenever a path gets cheaper, so the next change
+ * that makes it chattier again gets caught. */
+
+static struct
+{
+	int which;
+	unsigned long requests, per_unit, roundtrips;
+} budgets[] = {
+	{ STAT_MANAGE, 25, 0, 8 },
+	{ STAT_UNMANAGE, 7, 0, 0 },
+	{ STAT_FOCUS, 2, 0, 0 },
+	{ STAT_MOVE, 8, 200, 2 },
+};
+
+// traffic already put down to a handler that has finished
+static unsigned long claimed_requests = 0, claimed_roundtrips = 0;
+
+int over_budget = 0;
+
+#define EV(t) [t] = #t
+
+static const char *event_names[LASTEvent] = {
+	EV(KeyPress), EV(KeyRelease), EV(ButtonPress), EV(ButtonRelease),
+	EV(MotionNotify), EV(EnterNotify), EV(LeaveNotify), EV(FocusIn),
+	EV(FocusOut), EV(KeymapNotify), EV(Expose), EV(GraphicsExpose),
+	EV(NoExpose), EV(VisibilityNotify), EV(CreateNotify), EV(DestroyNotify),
+	EV(UnmapNotify), EV(MapNotify), EV(MapRequest), EV(ReparentNotify),
+	EV(ConfigureNotify), EV(ConfigureRequest), EV(GravityNotify), EV(ResizeRequest),
+	EV(CirculateNotify), EV(CirculateRequest), EV(PropertyNotify), EV(SelectionClear),
+	EV(SelectionRequest), EV(SelectionNotify), EV(ColormapNotify), EV(ClientMessage),
+	EV(MappingNotify), EV(GenericEvent)
+};
+
+static const char *handler_names[NUM_HANDLERS] = {
+	"manage", "unmanage", "paint", "move", "resize", "taskbar/menu", "focus", "map latency"
+};
+
+static void add_sample(Histogram *h, unsigned long long ns)
+{
+	unsigned int bucket = 0;
+
+	while (ns >> (bucket + 1) && bucket < NUM_BUCKETS - 1)
+	{
+		bucket++;
+	}
+	h->buckets[bucket]++;
+	h->count++;
+	h->total_ns += ns;
+	if (ns > h->max_ns)
+	{
+		h->max_ns = ns;
+	}
+}
+
+void start_mark(Mark *mark)
+{
+	mark->ns = get_time_ns();
+	mark->requests = NextRequest(dsply);
+	mark->roundtrips = roundtrips;
+	mark->claimed_requests = claimed_requests;
+	mark->claimed_roundtrips = claimed_roundtrips;
+	mark->units = 0;
+}
+
+static void add_traffic(Histogram *h, Mark *mark)
+{
+	h->requests += NextRequest(dsply) - mark->requests;
+	h->roundtrips += roundtrips - mark->roundtrips;
+}
+
+static void check_budget(int which, unsigned long requests, unsigned long trips, unsigned long units)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof budgets / sizeof budgets[0]; i++)
+	{
+		if (budgets[i].which == which && (requests > budgets[i].requests + (units * budgets[i].per_unit) / 100 || trips > budgets[i].roundtrips))
+		{
+			err("over budget: %s made %lu requests and %lu round trips, allowed %lu and %lu", handler_names[which], requests, trips, budgets[i].requests + (units * budgets[i].per_unit) / 100, budgets[i].roundtrips);
+			over_budget = 1;
+		}
+	}
+}
+
+void record_event(int type, Mark *mark)
+{
+	Histogram *h = &event_hist[(type >= 0 && type < LASTEvent) ? type : LASTEvent];
+	add_sample(h, get_time_ns() - mark->ns);
+	add_traffic(h, mark);
+}
+
+void record_handler(int which, Mark *mark)
+{
+	unsigned long requests = NextRequest(dsply) - mark->requests;
+	unsigned long trips = roundtrips - mark->roundtrips;
+
+	// leave out what the handlers this one called have accounted for
+	requests -= claimed_requests - mark->claimed_requests;
+	trips -= claimed_roundtrips - mark->claimed_roundtrips;
+	claimed_requests += requests;
+	claimed_roundtrips += trips;
+
+	add_sample(&handler_hist[which], get_time_ns() - mark->ns);
+	add_traffic(&handler_hist[which], mark);
+	if (opt_budget)
+	{
+		check_budget(which, requests, trips, mark->units);
+	}
+}
+
+void record_latency(int which, unsigned long long start)
+{
+	add_sample(&handler_hist[which], get_time_ns() - start);
+}
+
+void count_roundtrip(const char *subsystem)
+{
+	int i;
+
+	roundtrips++;
+	for (i = 0; i < num_subsystems; i++)
+	{
+		if (subsystems[i].name == subsystem || strcmp(subsystems[i].name, subsystem) == 0)
+		{
+			subsystems[i].roundtrips++;
+			return;
+		}
+	}
+	if (num_subsystems < MAX_SUBSYSTEMS)
+	{
+		subsystems[num_subsystems].name = subsystem;
+		subsystems[num_subsystems].roundtrips = 1;
+		num_subsystems++;
+	}
+}
+
+static char *show_ns(char *buf, size_t size, unsigned long long ns)
+{
+	if (ns < 1000ULL)
+	{
+		snprintf(buf, size, "%lluns", ns);
+	}
+	else if (ns < 1000000ULL)
+	{
+		snprintf(buf, size, "%.1fus", ns / 1e3);
+	}
+	else if (ns < 1000000000ULL)
+	{
+		snprintf(buf, size, "%.1fms", ns / 1e6);
+	}
+	else
+	{
+		snprintf(buf, size, "%.1fs", ns / 1e9);
+	}
+	return buf;
+}
+
+static void dump_histogram(const char *name, Histogram *h)
+{
+	char line[1024], mean[16], max[16], bound[16];
+	size_t len;
+	unsigned int i;
+
+	if (h->count == 0)
+	{
+		return;
+	}
+	len = snprintf(line, sizeof line, "%-18s %8lu, mean %s, max %s, %.1f requests and %.2f round trips each:", name, h->count, show_ns(mean, sizeof mean, h->total_ns / h->count), show_ns(max, sizeof max, h->max_ns), (double)h->requests / h->count, (double)h->roundtrips / h->count);
+	for (i = 0; i < NUM_BUCKETS && len < sizeof line; i++)
+	{
+		if (h->buckets[i] != 0)
+		{
+			len += snprintf(line + len, sizeof line - len, " <%s %lu", show_ns(bound, sizeof bound, 2ULL << i), h->buckets[i]);
+		}
+	}
+	err("%s", line);
+}
+
+static void dump_coalesce_stats(void)
+{
+	unsigned long merged = coalesce_stats.configures + coalesce_stats.exposes + coalesce_stats.properties + coalesce_stats.shapes;
+
+	err("events dispatched: %lu of %lu received (%.1f%% merged away: %lu ConfigureRequest, %lu Expose, %lu PropertyNotify, %lu ShapeNotify)", coalesce_stats.received - merged, coalesce_stats.received, coalesce_stats.received ? 100.0 * merged / coalesce_stats.received : 0.0, coalesce_stats.configures, coalesce_stats.exposes, coalesce_stats.properties, coalesce_stats.shapes);
+}
+
+/* The flood control counters for each client that has sent us
+ * anything, with its window id and name so it can be tracked down. */
+
+static void dump_flood_stats(void)
+{
+	Client *c;
+
+	err("events from each client (over budget, work deferred, merged):");
+	for (c = head_client; c != NULL; c = c->next)
+	{
+		if (c->flood.events != 0)
+		{
+			err("%#10lx %-30.30s %10lu %8lu %8lu %8lu", c->window, c->name ? c->name : "(unnamed)", c->flood.events, c->flood.over, c->flood.deferred, c->flood.merged);
+		}
+	}
+}
+
+void dump_stats(void)
+{
+	int i;
+
+	err("time spent per event type:");
+	for (i = 0; i < LASTEvent; i++)
+	{
+		dump_histogram(event_names[i] ? event_names[i] : "unknown", &event_hist[i]);
+	}
+	dump_histogram("extension", &event_hist[LASTEvent]);
+	err("time spent per handler:");
+	for (i = 0; i < NUM_HANDLERS; i++)
+	{
+		dump_histogram(handler_names[i], &handler_hist[i]);
+	}
+	err("round trips: %lu", roundtrips);
+	for (i = 0; i < num_subsystems; i++)
+	{
+		err("%-18s %8lu", subsystems[i].name, subsystems[i].roundtrips);
+	}
+	if (over_budget)
+	{
+		err("request budgets have been exceeded");
+	}
+	err("motion events: %lu of %lu handled", motion_stats.handled, motion_stats.received);
+	err("titlebar repaints: %lu of %lu requested, task button repaints: %lu of %lu requested, taskbar repaints: %lu of %lu requested", paint_stats.frame_paints, paint_stats.frame_requests, paint_stats.taskbutton_paints, paint_stats.taskbutton_requests, paint_stats.taskbar_paints, paint_stats.taskbar_requests);
+	dump_coalesce_stats();
+	dump_flood_stats();
+}
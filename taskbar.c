@@ -23,15 +23,86 @@
 static void draw_menubar(void);
 static unsigned int update_menuitem(int);
 static void draw_menuitem(unsigned int, unsigned int);
+static void update_taskbar_layout(void);
+static Client *client_at(int, float);
+static void draw_taskbutton(Client *, float);
 
 Window taskbar;
 #ifdef XFT
 XftDraw *tbxftdraw;
 #endif
 
+/* Everything shown in the taskbar (task buttons and the menubar) is
+ * drawn into this pixmap first and then copied to the window, so the
+ * user never sees a half drawn or cleared bar, and a compositor gets
+ * one damage rectangle per update. */
+
+static Pixmap taskbar_pm;
+
+/* The layout of the task buttons is cached: slot i holds the client
+ * whose button is i'th from the left (and each client knows its own
+ * slot). It only has to be worked out again when clients come or go;
+ * until then finding the button under the pointer, or repainting a
+ * single button, doesn't involve walking the client list. */
+
+static Client **taskbar_slots = NULL;
+static unsigned int num_slots = 0, slots_size = 0;
+static Bool layout_valid = False;
+
+void invalidate_taskbar_layout(void)
+{
+	layout_valid = False;
+}
+
+static void update_taskbar_layout(void)
+{
+	Client *c, **new_slots;
+	unsigned int n = 0;
+
+	if (layout_valid)
+	{
+		return;
+	}
+	for (c = head_client; c != NULL; c = c->next)
+	{
+		n++;
+	}
+	if (n > slots_size)
+	{
+		new_slots = (Client **)realloc(taskbar_slots, n * 2 * sizeof(Client *));
+		if (new_slots == NULL)
+		{
+			err("unable to allocate taskbar layout");
+			exit(1);
+		}
+		taskbar_slots = new_slots;
+		slots_size = n * 2;
+	}
+	for (c = head_client, n = 0; c != NULL; c = c->next, n++)
+	{
+		c->taskbar_slot = n;
+		taskbar_slots[n] = c;
+	}
+	num_slots = n;
+	layout_valid = True;
+}
+
+static Client *client_at(int x, float button_width)
+{
+	unsigned int slot = (unsigned int)(x / button_width);
+
+	update_taskbar_layout();
+	if (x < 0 || slot >= num_slots)
+	{
+		return NULL;
+	}
+	return taskbar_slots[slot];
+}
+
 void make_taskbar(void)
 {
 	XSetWindowAttributes pattr;
+	unsigned int dw = DisplayWidth(dsply, screen);
 
 	pattr.override_redirect = True;
 	pattr.background_pixel = empty_col.pixel;
@@ -39,13 +110,24 @@ void make_taskbar(void)
 	pattr.event_mask = ChildMask|ButtonPressMask|ExposureMask|EnterWindowMask;
 	taskbar = XCreateWindow(dsply, root, 0 - DEF_BORDERWIDTH, 0 - DEF_BORDERWIDTH, DisplayWidth(dsply, screen), BARHEIGHT() - DEF_BORDERWIDTH, DEF_BORDERWIDTH, DefaultDepth(dsply, screen), CopyFromParent, DefaultVisual(dsply, screen), CWOverrideRedirect|CWBackPixel|CWBorderPixel|CWEventMask, &pattr);
 
+	taskbar_pm = XCreatePixmap(dsply, taskbar, dw, BARHEIGHT() - DEF_BORDERWIDTH, DefaultDepth(dsply, screen));
+	XFillRectangle(dsply, taskbar_pm, empty_gc, 0, 0, dw, BARHEIGHT() - DEF_BORDERWIDTH);
+
 	XMapWindow(dsply, taskbar);
 
 #ifdef XFT
-	tbxftdraw = XftDrawCreate(dsply, (Drawable) taskbar, DefaultVisual(dsply, DefaultScreen(dsply)), DefaultColormap(dsply, DefaultScreen(dsply)));
+	tbxftdraw = XftDrawCreate(dsply, (Drawable) taskbar_pm, DefaultVisual(dsply, DefaultScreen(dsply)), DefaultColormap(dsply, DefaultScreen(dsply)));
 #endif
 }
 
+/* Copy part of the back buffer to the taskbar window. This is also
+ * all that an Expose on the taskbar needs. */
+
+void present_taskbar(int x, int width)
+{
+	XCopyArea(dsply, taskbar_pm, taskbar, text_gc, x, 0, width, BARHEIGHT() - DEF_BORDERWIDTH, x, 0);
+}
+
 void remember_hidden(void)
 {
 	Client *c;
@@ -108,8 +190,9 @@ void lclick_taskbar(int x)
 	XSetWindowAttributes pattr;
 
 	float button_width;
-	unsigned int button_clicked, old_button_clicked, i;
+	unsigned int button_clicked, old_button_clicked;
 	Client *c, *exposed_c, *old_c;
+	MotionStats drag = { 0, 0 };
 	if (head_client != NULL)
 	{
 		remember_hidden();
@@ -124,7 +207,7 @@ void lclick_taskbar(int x)
 		constraint_win = XCreateWindow(dsply, root, bounddims.x, bounddims.y, bounddims.width, bounddims.height, 0, CopyFromParent, InputOnly, CopyFromParent, 0, &pattr);
 		XMapWindow(dsply, constraint_win);
 
-		if (!(XGrabPointer(dsply, root, False, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, None, CurrentTime) == GrabSuccess))
+		if (!(ROUNDTRIP(XGrabPointer(dsply, root, False, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, None, CurrentTime)) == GrabSuccess))
 		{
 			XDestroyWindow(dsply, constraint_win);
 			return;
@@ -133,36 +216,42 @@ void lclick_taskbar(int x)
 		button_width = get_button_width();
 
 		button_clicked = (unsigned int)(x / button_width);
-		for (i = 0, c = head_client; i < button_clicked; i++)
+		c = client_at(x, button_width);
+		if (c != NULL)
 		{
-			c = c->next;
+			lclick_taskbutton(NULL, c);
 		}
 
-		lclick_taskbutton(NULL, c);
-
 		do
 		{
+			flush_redraws();
 			XMaskEvent(dsply, ExposureMask|MouseMask|KeyMask, &ev);
+			log_xevent(&ev);
 			switch (ev.type)
 			{
 				case Expose:
 					exposed_c = find_client(ev.xexpose.window, FRAME);
 					if (exposed_c)
 					{
-						redraw(exposed_c);
+						schedule_redraw(exposed_c);
 					}
 					break;
 				case MotionNotify:
+					compress_motion(&ev, &drag);
 					old_button_clicked = button_clicked;
 					button_clicked = (unsigned int)(ev.xmotion.x / button_width);
 					if (button_clicked != old_button_clicked)
 					{
 						old_c = c;
-						for (i = 0, c = head_client; i < button_clicked; i++)
+						c = client_at(ev.xmotion.x, button_width);
+						if (c != NULL)
 						{
-							c = c->next;
+							lclick_taskbutton(old_c, c);
+						}
+						else
+						{
+							c = old_c;
 						}
-						lclick_taskbutton(old_c, c);
 					}
 					break;
 				case KeyPress:
@@ -177,6 +266,9 @@ void lclick_taskbar(int x)
 		ungrab();
 
 		forget_hidden();
+#ifdef DEBUG
+		fprintf(stderr, "lclick_taskbar() : acted on %lu of %lu motion events\n", drag.handled, drag.received);
+#endif
 	}
 }
 
@@ -199,7 +291,7 @@ void rclick_taskbar(int x)
 	constraint_win = XCreateWindow(dsply, root, bounddims.x, bounddims.y, bounddims.width, bounddims.height, 0, CopyFromParent, InputOnly, CopyFromParent, 0, &pattr);
 	XMapWindow(dsply, constraint_win);
 
-	if (!(XGrabPointer(dsply, root, False, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, None, CurrentTime) == GrabSuccess))
+	if (!(ROUNDTRIP(XGrabPointer(dsply, root, False, MouseMask, GrabModeAsync, GrabModeAsync, constraint_win, None, CurrentTime)) == GrabSuccess))
 	{
 		XDestroyWindow(dsply, constraint_win);
 		return;
@@ -210,9 +302,11 @@ void rclick_taskbar(int x)
 	do
 	{
 		XMaskEvent(dsply, MouseMask|KeyMask, &ev);
+		log_xevent(&ev);
 		switch (ev.type)
 		{
 			case MotionNotify:
+				compress_motion(&ev, NULL);
 				current_item = update_menuitem(ev.xmotion.x);
 				break;
 			case ButtonRelease:
@@ -245,6 +339,7 @@ void rclick_root(void)
 	do
 	{
 		XMaskEvent(dsply, MouseMask|KeyMask, &ev);
+		log_xevent(&ev);
 		switch (ev.type)
 		{
 			case MotionNotify:
@@ -268,43 +363,72 @@ void rclick_root(void)
 
 void redraw_taskbar(void)
 {
-	unsigned int i;
-	int button_startx, button_iwidth;
 	float button_width;
 	Client *c;
 
 	button_width = get_button_width();
-	XClearWindow(dsply, taskbar);
+	XFillRectangle(dsply, taskbar_pm, empty_gc, 0, 0, DisplayWidth(dsply, screen), BARHEIGHT() - DEF_BORDERWIDTH);
 
 	if (showing_taskbar == 0)
 	{
+		present_taskbar(0, DisplayWidth(dsply, screen));
 		return;
 	}
 
-	for (c = head_client, i = 0; c != NULL; c = c->next, i++)
+	for (c = head_client; c != NULL; c = c->next)
 	{
-		button_startx = (int)(i * button_width);
-		button_iwidth = (unsigned int)(((i + 1) * button_width) - button_startx);
-		if (button_startx != 0)
-		{
-			XDrawLine(dsply, taskbar, border_gc, button_startx - 1, 0, button_startx - 1, BARHEIGHT() - DEF_BORDERWIDTH);
-		}
-		if (c == focused_client)
-		{
-			XFillRectangle(dsply, taskbar, active_gc, button_startx, 0, button_iwidth, BARHEIGHT() - DEF_BORDERWIDTH);
-		}
-		else
-		{
-			XFillRectangle(dsply, taskbar, inactive_gc, button_startx, 0, button_iwidth, BARHEIGHT() - DEF_BORDERWIDTH);
-		}
-		if (!c->trans && c->name != NULL)
-		{
+		draw_taskbutton(c, button_width);
+	}
+	present_taskbar(0, DisplayWidth(dsply, screen));
+}
+
+/* Repaint just the one button, e.g. when its client gains or loses
+ * the focus or changes its name. */
+
+void redraw_taskbutton(Client *c)
+{
+	float button_width;
+	int button_startx;
+
+	if (showing_taskbar == 0)
+	{
+		return;
+	}
+	button_width = get_button_width();
+	draw_taskbutton(c, button_width);
+	button_startx = (int)(c->taskbar_slot * button_width);
+	// include the divider line to the left of the button
+	present_taskbar(button_startx > 0 ? button_startx - 1 : 0, (int)(((c->taskbar_slot + 1) * button_width) - button_startx) + 1);
+}
+
+static void draw_taskbutton(Client *c, float button_width)
+{
+	int button_startx, button_iwidth;
+	TitleFit *fit;
+
+	button_startx = (int)(c->taskbar_slot * button_width);
+	button_iwidth = (unsigned int)(((c->taskbar_slot + 1) * button_width) - button_startx);
+	if (button_startx != 0)
+	{
+		XDrawLine(dsply, taskbar_pm, border_gc, button_startx - 1, 0, button_startx - 1, BARHEIGHT() - DEF_BORDERWIDTH);
+	}
+	if (c == focused_client)
+	{
+		XFillRectangle(dsply, taskbar_pm, active_gc, button_startx, 0, button_iwidth, BARHEIGHT() - DEF_BORDERWIDTH);
+	}
+	else
+	{
+		XFillRectangle(dsply, taskbar_pm, inactive_gc, button_startx, 0, button_iwidth, BARHEIGHT() - DEF_BORDERWIDTH);
+	}
+	update_title(c);
+	if (!c->trans && c->name != NULL)
+	{
+		fit = fit_title(c, &c->button_fit, button_iwidth - (SPACE * 2));
 #ifdef XFT
-			XftDrawString8(tbxftdraw, &xft_detail, xftfont, button_startx + SPACE, SPACE + xftfont->ascent, (unsigned char *)c->name, strlen(c->name));
+		draw_title(c, fit, tbxftdraw, button_startx + SPACE);
 #else
-			XDrawString(dsply, taskbar, text_gc, button_startx + SPACE, SPACE + font->ascent, c->name, strlen(c->name));
+		draw_title(c, fit, taskbar_pm, button_startx + SPACE);
 #endif
-		}
 	}
 }
 
@@ -312,7 +436,7 @@ void draw_menubar(void)
 {
 	unsigned int i, dw;
 	dw = DisplayWidth(dsply, screen);
-	XFillRectangle(dsply, taskbar, menu_gc, 0, 0, dw, BARHEIGHT() - DEF_BORDERWIDTH);
+	XFillRectangle(dsply, taskbar_pm, menu_gc, 0, 0, dw, BARHEIGHT() - DEF_BORDERWIDTH);
 
 	for (i = 0; i < num_menuitems; i++)
 	{
@@ -321,10 +445,11 @@ void draw_menubar(void)
 #ifdef XFT
 			XftDrawString8(tbxftdraw, &xft_detail, xftfont, menuitems[i].x + (SPACE * 2), xftfont->ascent + SPACE, (unsigned char *)menuitems[i].label, strlen(menuitems[i].label));
 #else
-			XDrawString(dsply, taskbar, text_gc, menuitems[i].x + (SPACE * 2), font->ascent + SPACE, menuitems[i].label, strlen(menuitems[i].label));
+			XDrawString(dsply, taskbar_pm, text_gc, menuitems[i].x + (SPACE * 2), font->ascent + SPACE, menuitems[i].label, strlen(menuitems[i].label));
 #endif
 		}
 	}
+	present_taskbar(0, dw);
 }
 
 unsigned int update_menuitem(int mousex)
@@ -371,57 +496,39 @@ void draw_menuitem(unsigned int index, unsigned int active)
 {
 	if (active)
 	{
-		XFillRectangle(dsply, taskbar, selected_gc, menuitems[index].x, 0, menuitems[index].width, BARHEIGHT() - DEF_BORDERWIDTH);
+		XFillRectangle(dsply, taskbar_pm, selected_gc, menuitems[index].x, 0, menuitems[index].width, BARHEIGHT() - DEF_BORDERWIDTH);
 	}
 	else
 	{
-		XFillRectangle(dsply, taskbar, menu_gc, menuitems[index].x, 0, menuitems[index].width, BARHEIGHT() - DEF_BORDERWIDTH);
+		XFillRectangle(dsply, taskbar_pm, menu_gc, menuitems[index].x, 0, menuitems[index].width, BARHEIGHT() - DEF_BORDERWIDTH);
 	}
 #ifdef XFT
 	XftDrawString8(tbxftdraw, &xft_detail, xftfont, menuitems[index].x + (SPACE * 2), xftfont->ascent + SPACE, (unsigned char *)menuitems[index].label, strlen(menuitems[index].label));
 #else
-	XDrawString(dsply, taskbar, text_gc, menuitems[index].x + (SPACE * 2), font->ascent + SPACE, menuitems[index].label, strlen(menuitems[index].label));
+	XDrawString(dsply, taskbar_pm, text_gc, menuitems[index].x + (SPACE * 2), font->ascent + SPACE, menuitems[index].label, strlen(menuitems[index].label));
 #endif
+	present_taskbar(menuitems[index].x, menuitems[index].width);
 }
 
 float get_button_width(void)
 {
-	unsigned int nwins = 0;
-	Client *c = head_client;
-	while (c != NULL)
-	{
-		nwins++;
-		c = c->next;
-	}
-	return ((float)(DisplayWidth(dsply, screen) + DEF_BORDERWIDTH)) / nwins;
+	update_taskbar_layout();
+	return ((float)(DisplayWidth(dsply, screen) + DEF_BORDERWIDTH)) / num_slots;
 }
 
 void cycle_previous(void)
 {
 	Client *c = focused_client;
-	Client *original_c = c;
 	if (head_client != NULL && head_client->next != NULL) // at least 2 windows exist
 	{
-		if (c == NULL)
-		{
-			c = head_client;
-		}
-		if (c == head_client)
+		if (c == NULL || c->prev == NULL)
 		{
-			original_c = NULL;
+			c = tail_client;
 		}
-		do
+		else
 		{
-			if (c->next == NULL)
-			{
-				c = head_client;
-			}
-			else
-			{
-				c = c->next;
-			}
+			c = c->prev;
 		}
-		while (c->next != original_c);
 		lclick_taskbutton(NULL, c);
 	}
 }
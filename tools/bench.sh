@@ -0,0 +1,81 @@
+#!/bin/sh
+# Run the standard stress scenarios against windowlab on an Xvfb and
+# print the results as a JSON array. Used by 'make bench'.
+#
+# BENCH_DISPLAY picks the display for the Xvfb (default :57),
+# BENCH_WINDOWS the number of windows in most scenarios (default 300),
+# BENCH_STARTUP_WINDOWS the number there when windowlab starts
+# (default 1000) and BENCH_MASS_WINDOWS the number opened and then
+# closed (in the reverse order, and shuffled) in one go (default 5000).
+# Anything in WINDOWLAB_ARGS is passed to windowlab. tools/lookup,
+# which times finding clients without an X server, is run first.
+#
+# windowlab is run with -budget, and the benchmark fails if it went
+# over any of its request budgets (it exits with status 3 when it's
+# told to quit).
+
+DISPLAY_NAME=${BENCH_DISPLAY:-:57}
+WINDOWS=${BENCH_WINDOWS:-300}
+STARTUP_WINDOWS=${BENCH_STARTUP_WINDOWS:-1000}
+MASS_WINDOWS=${BENCH_MASS_WINDOWS:-5000}
+WINDOWLAB="./windowlab -display $DISPLAY_NAME -budget $WINDOWLAB_ARGS"
+STRESS="tools/stress -display $DISPLAY_NAME"
+RESULTS=$(mktemp) || exit 1
+
+cleanup()
+{
+	[ -n "$WM_PID" ] && kill "$WM_PID" 2>/dev/null && wait "$WM_PID" 2>/dev/null
+	[ -n "$XVFB_PID" ] && kill "$XVFB_PID" 2>/dev/null
+	rm -f "$RESULTS"
+}
+trap cleanup EXIT INT TERM
+
+if ! command -v Xvfb >/dev/null 2>&1; then
+	echo "bench: Xvfb is needed to run the benchmarks" >&2
+	exit 1
+fi
+
+Xvfb "$DISPLAY_NAME" -screen 0 1280x1024x24 -nolisten tcp >/dev/null 2>&1 &
+XVFB_PID=$!
+if command -v xdpyinfo >/dev/null 2>&1; then
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		xdpyinfo -display "$DISPLAY_NAME" >/dev/null 2>&1 && break
+		sleep 0.5
+	done
+else
+	sleep 2
+fi
+
+fail=0
+
+tools/lookup >>"$RESULTS" || fail=1
+
+$STRESS -scenario startup -windows "$STARTUP_WINDOWS" -exec "exec $WINDOWLAB" >>"$RESULTS" || fail=1
+
+$WINDOWLAB &
+WM_PID=$!
+sleep 1
+$STRESS -wm $WM_PID -scenario map -windows "$WINDOWS" >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario map -windows "$MASS_WINDOWS" -closeorder reverse >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario map -windows "$MASS_WINDOWS" -closeorder shuffle >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario title -windows "$WINDOWS" -count 20000 >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario title -windows "$WINDOWS" -count 2000 -titlelen 4000 >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario configure -windows "$WINDOWS" -count 10000 >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario iconify -windows "$WINDOWS" >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario churn -windows "$WINDOWS" -duration 10 >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario latency -windows 100 -duration 10 >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario drag -windows 10 -count 50 >>"$RESULTS" || fail=1
+$STRESS -wm $WM_PID -scenario focus -windows 10 -count 1000 >>"$RESULTS" || fail=1
+
+kill "$WM_PID"
+wait "$WM_PID"
+if [ $? -eq 3 ]; then
+	echo "bench: windowlab went over its request budgets" >&2
+	fail=1
+fi
+WM_PID=
+
+echo "["
+sed '$!s/$/,/' "$RESULTS"
+echo "]"
+exit $fail
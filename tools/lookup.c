@@ -0,0 +1,188 @@
+/* WindowLab - an X11 window manager
+ * Copyright (c) 2001-2010 Nick Gravgaard
+ * me at nickgravgaard.com
+ * http://nickgravgaard.com/windowlab/
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/* lookup - time find_client on its own, with no X server involved.
+ *
+ * It's linked against windowlab's own objects (main.c is built with
+ * its main renamed), so what's timed is the real client index. For
+ * 10, 100, 1000 and 10000 clients it indexes that many made up
+ * clients, then looks up every window and frame (hits) and a window
+ * id next to each of them (misses, as for a client's subwindows),
+ * in a shuffled order, printing the average time per lookup as one
+ * JSON object per line. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../windowlab.h"
+
+#define WINDOWS_PER_APP 4
+
+typedef struct Probe
+{
+	Window w;
+	int mode;
+} Probe;
+
+static long opt_lookups = 20000000;
+static volatile unsigned long sink;
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: lookup [-lookups <n>]\n");
+	exit(2);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void shuffle(Probe *probes, int n)
+{
+	Probe t;
+	int i, j;
+
+	for (i = n - 1; i > 0; i--)
+	{
+		j = rand() % (i + 1);
+		t = probes[i];
+		probes[i] = probes[j];
+		probes[j] = t;
+	}
+}
+
+/* Look every probe up, over and over until about opt_lookups have
+ * been done, and return the nanoseconds each one took. Every one of
+ * them has to come back found (or not) as expected. */
+
+static double time_probes(Probe *probes, int n, Bool hits)
+{
+	unsigned long long start;
+	unsigned long found = 0;
+	long rounds = opt_lookups / n, r;
+	int i;
+
+	if (rounds < 1)
+	{
+		rounds = 1;
+	}
+	start = now_ns();
+	for (r = 0; r < rounds; r++)
+	{
+		for (i = 0; i < n; i++)
+		{
+			found += (find_client(probes[i].w, probes[i].mode) != NULL);
+		}
+	}
+	sink = found;
+	if (found != (hits ? (unsigned long)rounds * n : 0))
+	{
+		fprintf(stderr, "lookup: found %lu of %ld %s\n", found, rounds * n, hits ? "hits" : "misses");
+		exit(1);
+	}
+	return (double)(now_ns() - start) / ((double)rounds * n);
+}
+
+/* Window ids are made up to look like the server's: each client
+ * connection hands out ids from its own block, a few windows to an
+ * application, and the frames all come from ours, one after another. */
+
+static void run_lookup(int num_clients)
+{
+	Client *clients;
+	Probe *hits, *misses;
+	Window base;
+	int i;
+
+	clients = calloc(num_clients, sizeof *clients);
+	hits = malloc(2 * num_clients * sizeof *hits);
+	misses = malloc(2 * num_clients * sizeof *misses);
+	if (clients == NULL || hits == NULL || misses == NULL)
+	{
+		fprintf(stderr, "lookup: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < num_clients; i++)
+	{
+		base = (Window)(i / WINDOWS_PER_APP + 3) << 21;
+		clients[i].window = base | (0x0a + (i % WINDOWS_PER_APP) * 7);
+		clients[i].frame = (Window)2 << 21 | (0x100 + i * 3);
+		index_client(&clients[i]);
+
+		hits[2 * i].w = clients[i].window;
+		hits[2 * i].mode = WINDOW;
+		hits[2 * i + 1].w = clients[i].frame;
+		hits[2 * i + 1].mode = FRAME;
+		misses[2 * i].w = clients[i].window + 1;
+		misses[2 * i].mode = WINDOW;
+		misses[2 * i + 1].w = clients[i].frame + 1;
+		misses[2 * i + 1].mode = FRAME;
+	}
+	shuffle(hits, 2 * num_clients);
+	shuffle(misses, 2 * num_clients);
+
+	printf("{\"scenario\": \"lookup\", \"clients\": %d, ", num_clients);
+	printf("\"hit_ns\": %.2f, ", time_probes(hits, 2 * num_clients, True));
+	printf("\"miss_ns\": %.2f}\n", time_probes(misses, 2 * num_clients, False));
+
+	for (i = 0; i < num_clients; i++)
+	{
+		unindex_client(&clients[i]);
+	}
+	free(clients);
+	free(hits);
+	free(misses);
+}
+
+int main(int argc, char **argv)
+{
+	static const int sizes[] = { 10, 100, 1000, 10000 };
+	unsigned int i;
+
+	for (i = 1; i < (unsigned int)argc; i++)
+	{
+		if (strcmp(argv[i], "-lookups") == 0 && i + 1 < (unsigned int)argc)
+		{
+			opt_lookups = atol(argv[++i]);
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (opt_lookups < 1)
+	{
+		usage();
+	}
+
+	srand(1);
+	// smallest first, so the index has only grown as far as each needs
+	for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++)
+	{
+		run_lookup(sizes[i]);
+	}
+	return 0;
+}
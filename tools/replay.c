@@ -0,0 +1,369 @@
+/* WindowLab - an X11 window manager
+ * Copyright (c) 2001-2010 Nick Gravgaard
+ * me at nickgravgaard.com
+ * http://nickgravgaard.com/windowlab/
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/* replay - play a recording made with windowlab -record back at a
+ * windowlab running on another display (normally an Xvfb), so that a
+ * captured session can be turned into a repeatable test.
+ *
+ * Each client window in the recording gets a stand-in window of our
+ * own, which is mapped, configured, retitled, iconified, unmapped and
+ * destroyed when the original was. The pointer is warped to wherever
+ * it was seen; key presses and button clicks need the XTest extension
+ * (build with -DXTEST) and are skipped without it. Events are sent at
+ * the recorded pace, scaled by -speed. At the end windowlab is sent
+ * SIGUSR1 (if we were told its pid with -wm), so that it prints the
+ * time spent in each of its handlers. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#ifdef XTEST
+#include <X11/extensions/XTest.h>
+#endif
+#include "../record.h"
+
+typedef struct StandIn
+{
+	uint32_t recorded;
+	Window w;
+} StandIn;
+
+static Display *dsply;
+static Atom wm_change_state;
+static StandIn *standins = NULL;
+static int num_standins = 0, standins_size = 0;
+static unsigned long replayed[LASTEvent], skipped[LASTEvent];
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: replay [-display <display>] [-speed <factor>] [-wm <pid>] <recording>\n");
+	exit(2);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until(unsigned long long when)
+{
+	unsigned long long now = now_ns();
+	struct timespec ts;
+
+	if (when <= now)
+	{
+		return;
+	}
+	ts.tv_sec = (when - now) / 1000000000ULL;
+	ts.tv_nsec = (when - now) % 1000000000ULL;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+	{
+		continue;
+	}
+}
+
+static Window find_standin(uint32_t recorded)
+{
+	int i;
+
+	for (i = 0; i < num_standins; i++)
+	{
+		if (standins[i].recorded == recorded)
+		{
+			return standins[i].w;
+		}
+	}
+	return None;
+}
+
+static Window make_standin(RecordedEvent *r)
+{
+	Window w;
+	char name[64];
+
+	if (num_standins == standins_size)
+	{
+		standins_size = standins_size ? standins_size * 2 : 64;
+		standins = realloc(standins, standins_size * sizeof *standins);
+		if (standins == NULL)
+		{
+			fprintf(stderr, "replay: out of memory\n");
+			exit(1);
+		}
+	}
+	w = XCreateSimpleWindow(dsply, DefaultRootWindow(dsply), r->x, r->y, r->width ? r->width : 100, r->height ? r->height : 100, 1, BlackPixel(dsply, DefaultScreen(dsply)), WhitePixel(dsply, DefaultScreen(dsply)));
+	snprintf(name, sizeof name, "stand-in for 0x%lx", (unsigned long)r->window);
+	XStoreName(dsply, w, name);
+	standins[num_standins].recorded = r->window;
+	standins[num_standins].w = w;
+	num_standins++;
+	return w;
+}
+
+static void forget_standin(uint32_t recorded)
+{
+	int i;
+
+	for (i = 0; i < num_standins; i++)
+	{
+		if (standins[i].recorded == recorded)
+		{
+			standins[i] = standins[--num_standins];
+			return;
+		}
+	}
+}
+
+/* Stand-in titles are as long as the recorded ones, so fitting them
+ * into the titlebar costs about what it did. */
+
+static void retitle(Window w, unsigned int len)
+{
+	static unsigned int generation = 0;
+	char *name;
+	unsigned int i;
+
+	name = malloc(len + 1);
+	if (name == NULL)
+	{
+		return;
+	}
+	snprintf(name, len + 1, "%u ", generation++);
+	for (i = strlen(name); i < len; i++)
+	{
+		name[i] = 'a' + (i % 26);
+	}
+	name[len] = '\0';
+	XStoreName(dsply, w, name);
+	free(name);
+}
+
+static Bool replay_event(RecordedEvent *r)
+{
+	Window w = r->window ? find_standin(r->window) : None;
+	XWindowChanges wc;
+	XEvent ev;
+
+	switch (r->type)
+	{
+		case MapRequest:
+			if (w == None)
+			{
+				w = make_standin(r);
+			}
+			XMapWindow(dsply, w);
+			return True;
+		case ConfigureRequest:
+			if (w == None)
+			{
+				return False;
+			}
+			wc.x = r->x;
+			wc.y = r->y;
+			wc.width = r->width;
+			wc.height = r->height;
+			wc.stack_mode = r->detail;
+			XConfigureWindow(dsply, w, r->data & (CWX|CWY|CWWidth|CWHeight|CWStackMode), &wc);
+			return True;
+		case PropertyNotify:
+			if (w == None || r->data != XA_WM_NAME)
+			{
+				return False;
+			}
+			retitle(w, r->width);
+			return True;
+		case ClientMessage:
+			if (w == None)
+			{
+				return False;
+			}
+			memset(&ev, 0, sizeof ev);
+			ev.xclient.type = ClientMessage;
+			ev.xclient.window = w;
+			ev.xclient.message_type = wm_change_state;
+			ev.xclient.format = 32;
+			ev.xclient.data.l[0] = r->data;
+			XSendEvent(dsply, DefaultRootWindow(dsply), False, SubstructureRedirectMask|SubstructureNotifyMask, &ev);
+			return True;
+		case UnmapNotify:
+			if (w == None)
+			{
+				return False;
+			}
+			XUnmapWindow(dsply, w);
+			return True;
+		case DestroyNotify:
+			if (w == None)
+			{
+				return False;
+			}
+			XDestroyWindow(dsply, w);
+			forget_standin(r->window);
+			return True;
+		case MotionNotify:
+		case EnterNotify:
+#ifdef XTEST
+			XTestFakeMotionEvent(dsply, DefaultScreen(dsply), r->x, r->y, CurrentTime);
+#else
+			XWarpPointer(dsply, None, DefaultRootWindow(dsply), 0, 0, 0, 0, r->x, r->y);
+#endif
+			return True;
+#ifdef XTEST
+		case ButtonPress:
+		case ButtonRelease:
+			XTestFakeMotionEvent(dsply, DefaultScreen(dsply), r->x, r->y, CurrentTime);
+			XTestFakeButtonEvent(dsply, r->detail, r->type == ButtonPress, CurrentTime);
+			return True;
+		case KeyPress:
+		case KeyRelease:
+			XTestFakeKeyEvent(dsply, r->detail, r->type == KeyPress, CurrentTime);
+			return True;
+#endif
+	}
+	return False;
+}
+
+int main(int argc, char **argv)
+{
+	char *display = NULL, *filename = NULL;
+	double speed = 1.0;
+	pid_t wm = 0;
+	FILE *f;
+	RecordHeader header;
+	RecordedEvent r;
+	unsigned long long start, when = 0;
+	unsigned long total = 0;
+	int i;
+#ifdef XTEST
+	int dummy;
+#endif
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-display") == 0 && i + 1 < argc)
+		{
+			display = argv[++i];
+		}
+		else if (strcmp(argv[i], "-speed") == 0 && i + 1 < argc)
+		{
+			speed = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "-wm") == 0 && i + 1 < argc)
+		{
+			wm = atoi(argv[++i]);
+		}
+		else if (argv[i][0] != '-' && filename == NULL)
+		{
+			filename = argv[i];
+		}
+		else
+		{
+			usage();
+		}
+	}
+	if (filename == NULL || speed <= 0.0)
+	{
+		usage();
+	}
+
+	f = fopen(filename, "rb");
+	if (f == NULL)
+	{
+		fprintf(stderr, "replay: can't open '%s'\n", filename);
+		return 1;
+	}
+	if (fread(&header, sizeof header, 1, f) != 1 || memcmp(header.magic, RECORD_MAGIC, sizeof RECORD_MAGIC) != 0 || header.version != RECORD_VERSION)
+	{
+		fprintf(stderr, "replay: '%s' isn't a windowlab recording\n", filename);
+		return 1;
+	}
+	if (header.byte_order != RECORD_BYTE_ORDER)
+	{
+		fprintf(stderr, "replay: '%s' was recorded on a machine with a different byte order\n", filename);
+		return 1;
+	}
+
+	dsply = XOpenDisplay(display);
+	if (dsply == NULL)
+	{
+		fprintf(stderr, "replay: can't open display %s\n", XDisplayName(display));
+		return 1;
+	}
+#ifdef XTEST
+	if (!XTestQueryExtension(dsply, &dummy, &dummy, &dummy, &dummy))
+	{
+		fprintf(stderr, "replay: the display doesn't have the XTest extension\n");
+		return 1;
+	}
+#endif
+	if (DisplayWidth(dsply, DefaultScreen(dsply)) != header.screen_width || DisplayHeight(dsply, DefaultScreen(dsply)) != header.screen_height)
+	{
+		fprintf(stderr, "replay: recorded on a %ux%u screen, replaying on %dx%d\n", header.screen_width, header.screen_height, DisplayWidth(dsply, DefaultScreen(dsply)), DisplayHeight(dsply, DefaultScreen(dsply)));
+	}
+	wm_change_state = XInternAtom(dsply, "WM_CHANGE_STATE", False);
+
+	start = now_ns();
+	while (fread(&r, sizeof r, 1, f) == 1)
+	{
+		when += (unsigned long long)(r.delta_us * 1000.0 / speed);
+		if (start + when > now_ns())
+		{
+			XFlush(dsply);
+			sleep_until(start + when);
+		}
+		if (replay_event(&r))
+		{
+			replayed[r.type < LASTEvent ? r.type : 0]++;
+		}
+		else
+		{
+			skipped[r.type < LASTEvent ? r.type : 0]++;
+		}
+		total++;
+	}
+	fclose(f);
+	XSync(dsply, False);
+
+	printf("replayed %lu events in %.3fs (recorded over %.3fs)\n", total, (now_ns() - start) / 1e9, when * speed / 1e9);
+	for (i = 0; i < LASTEvent; i++)
+	{
+		if (replayed[i] || skipped[i])
+		{
+			printf("  type %2d: %lu replayed, %lu skipped\n", i, replayed[i], skipped[i]);
+		}
+	}
+	if (wm != 0 && kill(wm, SIGUSR1) != 0)
+	{
+		fprintf(stderr, "replay: can't signal windowlab (pid %d)\n", (int)wm);
+	}
+	XCloseDisplay(dsply);
+	return 0;
+}
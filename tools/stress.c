@@ -0,0 +1,1033 @@
+/* WindowLab - an X11 window manager
+ * Copyright (c) 2001-2010 Nick Gravgaard
+ * me at nickgravgaard.com
+ * http://nickgravgaard.com/windowlab/
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+
+/* stress - a load generator for benchmarking windowlab (see 'make
+ * bench'). It opens a number of windows and then has them map, unmap,
+ * retitle, resize and iconify, either as fast as windowlab will take
+ * it or at set rates, and prints what it managed as a line of JSON.
+ *
+ * Scenarios (-scenario):
+ *   map        map every window, then withdraw them all, in the order
+ *              they were mapped, in reverse (-closeorder reverse) or
+ *              shuffled (-closeorder shuffle)
+ *   title      change the windows' WM_NAMEs -count times in all
+ *   configure  resize the windows -count times in all
+ *   iconify    iconify every window with WM_CHANGE_STATE, then map them again
+ *   churn      all of the above at once, at the -maprate, -titlerate,
+ *              -configrate and -iconifyrate given, for -duration seconds
+ *   startup    map the windows before there's a window manager, start
+ *              one with -exec and time how long it takes to adopt them
+ *   latency    map and withdraw every window over and over for -duration
+ *              seconds, while another client times its round trips
+ *   drag       drag the windows by their titlebars -count times in all,
+ *              with 100 motion events to a drag
+ *   focus      click in the windows in turn, -count times in all
+ *
+ * drag and focus lay the windows out in a grid, so that none covers
+ * another, and need the XTest extension (build with -DXTEST) to
+ * press the buttons and move the pointer.
+ *
+ * Something is only counted once windowlab has acted on it: a map
+ * when the window is mapped, a withdrawal when it's back on the root,
+ * an iconify when it's unmapped. Title and configure changes aren't
+ * visible like that, so after the last one we resize a window of our
+ * own and wait for windowlab to pass that on; as it handles events in
+ * order, everything before has been handled too. With -wm (or -exec)
+ * the window manager's CPU time over the run is included. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#ifdef XTEST
+#include <X11/extensions/XTest.h>
+#endif
+
+#define TIMEOUT_NS (60ULL * 1000000000ULL)
+#define MAX_PROBES (1 << 20)
+#define DRAG_MOTIONS 100
+#define GRID_WIDTH 230
+#define GRID_HEIGHT 200
+#define GRID_TOP 160 // below the barrier
+
+typedef struct Stand
+{
+	Window w;
+	Bool mapped, framed;
+	int width;
+} Stand;
+
+static Display *dsply;
+static Window root;
+static Atom wm_change_state;
+static XContext stand_context;
+static Stand *stands;
+static int num_stands = 50;
+static Window barrier;
+static int barrier_width = 100;
+static Bool barrier_done;
+static Bool drag_started; // something (the drag's constraint window) was mapped on the root
+static int mapped_count = 0, framed_count = 0;
+static unsigned long counter = 0;
+static char *title_buf; // big enough for the counter and opt_titlelen
+static int title_size;
+
+static char *opt_display = NULL, *opt_scenario = "map", *opt_exec = NULL, *opt_closeorder = "forward";
+static int opt_count = 10000, opt_duration = 10, opt_titlelen = 40;
+static double opt_maprate = 20, opt_titlerate = 200, opt_configrate = 100, opt_iconifyrate = 10;
+static pid_t opt_wm = 0;
+
+static void usage(void)
+{
+	fprintf(stderr, "usage: stress [-display <display>] [-scenario map|title|configure|iconify|churn|startup|latency|drag|focus]\n"
+		"  [-windows <n>] [-count <n>] [-duration <s>] [-titlelen <n>]\n"
+		"  [-closeorder forward|reverse|shuffle]\n"
+		"  [-maprate|-titlerate|-configrate|-iconifyrate <per second>]\n"
+		"  [-wm <pid>] [-exec <window manager command>]\n");
+	exit(2);
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// the window manager's user + system time so far, in milliseconds, or -1
+static double wm_cpu_ms(pid_t pid)
+{
+	char path[64], buf[1024], *p;
+	unsigned long utime, stime;
+	FILE *f;
+
+	if (pid == 0)
+	{
+		return -1;
+	}
+	snprintf(path, sizeof path, "/proc/%d/stat", (int)pid);
+	f = fopen(path, "r");
+	if (f == NULL)
+	{
+		return -1;
+	}
+	p = fgets(buf, sizeof buf, f);
+	fclose(f);
+	// skip past the command name, which may contain spaces
+	if (p == NULL || (p = strrchr(buf, ')')) == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2)
+	{
+		return -1;
+	}
+	return (utime + stime) * 1000.0 / sysconf(_SC_CLK_TCK);
+}
+
+static void handle_event(XEvent *ev)
+{
+	Stand *s;
+
+	if (ev->xany.window == root)
+	{
+		if (ev->type == MapNotify)
+		{
+			drag_started = True;
+		}
+		return;
+	}
+	if (ev->xany.window == barrier)
+	{
+		if (ev->type == ConfigureNotify && !ev->xconfigure.send_event && ev->xconfigure.width == barrier_width)
+		{
+			barrier_done = True;
+		}
+		return;
+	}
+	if (XFindContext(dsply, ev->xany.window, stand_context, (XPointer *)&s) != 0)
+	{
+		return;
+	}
+	switch (ev->type)
+	{
+		case MapNotify:
+			if (!s->mapped)
+			{
+				s->mapped = True;
+				mapped_count++;
+			}
+			break;
+		case UnmapNotify:
+			if (s->mapped)
+			{
+				s->mapped = False;
+				mapped_count--;
+			}
+			break;
+		case ReparentNotify:
+			if (ev->xreparent.parent == root && s->framed)
+			{
+				s->framed = False;
+				framed_count--;
+			}
+			else if (ev->xreparent.parent != root && !s->framed)
+			{
+				s->framed = True;
+				framed_count++;
+			}
+			break;
+	}
+}
+
+// handle whatever has arrived, waiting up to timeout_ns for something
+static void pump(unsigned long long timeout_ns)
+{
+	XEvent ev;
+	fd_set fds;
+	struct timeval tv;
+
+	if (XPending(dsply) == 0 && timeout_ns > 0)
+	{
+		FD_ZERO(&fds);
+		FD_SET(ConnectionNumber(dsply), &fds);
+		tv.tv_sec = timeout_ns / 1000000000ULL;
+		tv.tv_usec = (timeout_ns % 1000000000ULL) / 1000;
+		select(ConnectionNumber(dsply) + 1, &fds, NULL, NULL, &tv);
+	}
+	while (XPending(dsply))
+	{
+		XNextEvent(dsply, &ev);
+		handle_event(&ev);
+	}
+}
+
+// wait until *count reaches target; False if the window manager gave up on us
+static Bool wait_for_count(int *count, int target)
+{
+	unsigned long long deadline = now_ns() + TIMEOUT_NS;
+
+	XFlush(dsply);
+	while (*count != target)
+	{
+		if (now_ns() > deadline)
+		{
+			fprintf(stderr, "stress: timed out with %d of %d done\n", *count, target);
+			return False;
+		}
+		pump(100000000ULL);
+	}
+	return True;
+}
+
+static Bool wait_for_barrier(void)
+{
+	unsigned long long deadline = now_ns() + TIMEOUT_NS;
+
+	barrier_width = (barrier_width == 100) ? 101 : 100;
+	barrier_done = False;
+	XResizeWindow(dsply, barrier, barrier_width, 100);
+	XFlush(dsply);
+	while (!barrier_done)
+	{
+		if (now_ns() > deadline)
+		{
+			fprintf(stderr, "stress: timed out waiting for the window manager\n");
+			return False;
+		}
+		pump(100000000ULL);
+	}
+	return True;
+}
+
+static Window make_window(int x, int y)
+{
+	Window w = XCreateSimpleWindow(dsply, root, x, y, 200, 150, 1, BlackPixel(dsply, DefaultScreen(dsply)), WhitePixel(dsply, DefaultScreen(dsply)));
+	XSelectInput(dsply, w, StructureNotifyMask);
+	return w;
+}
+
+static void make_stands(void)
+{
+	int i, dw = DisplayWidth(dsply, DefaultScreen(dsply)), dh = DisplayHeight(dsply, DefaultScreen(dsply));
+	char name[32];
+
+	stands = calloc(num_stands, sizeof *stands);
+	title_size = (opt_titlelen > 0 ? opt_titlelen : 0) + 32;
+	title_buf = malloc(title_size);
+	if (stands == NULL || title_buf == NULL)
+	{
+		fprintf(stderr, "stress: out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < num_stands; i++)
+	{
+		stands[i].w = make_window(rand() % (dw - 200), 20 + rand() % (dh - 200));
+		stands[i].width = 200;
+		snprintf(name, sizeof name, "stress %d", i);
+		XStoreName(dsply, stands[i].w, name);
+		XSaveContext(dsply, stands[i].w, stand_context, (XPointer)&stands[i]);
+	}
+}
+
+static void retitle(Stand *s)
+{
+	int len, i;
+
+	len = snprintf(title_buf, title_size, "stress %lu ", counter++);
+	for (i = len; i < opt_titlelen; i++)
+	{
+		title_buf[i] = 'a' + (i % 26);
+	}
+	title_buf[i] = '\0';
+	XStoreName(dsply, s->w, title_buf);
+}
+
+static void resize(Stand *s)
+{
+	s->width = (s->width == 200) ? 210 : 200;
+	XResizeWindow(dsply, s->w, s->width, 150);
+}
+
+static void iconify(Stand *s)
+{
+	XEvent ev;
+
+	memset(&ev, 0, sizeof ev);
+	ev.xclient.type = ClientMessage;
+	ev.xclient.window = s->w;
+	ev.xclient.message_type = wm_change_state;
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = IconicState;
+	XSendEvent(dsply, root, False, SubstructureRedirectMask|SubstructureNotifyMask, &ev);
+}
+
+static void map_all(void)
+{
+	int i;
+
+	for (i = 0; i < num_stands; i++)
+	{
+		XMapWindow(dsply, stands[i].w);
+	}
+}
+
+static void print_result(const char *scenario, const char *unit, unsigned long ops, unsigned long long start, unsigned long long end, double cpu_start, double cpu_end)
+{
+	double seconds = (end - start) / 1e9;
+
+	printf("{\"scenario\": \"%s\", \"windows\": %d, \"%s\": %lu, \"seconds\": %.3f, \"%s_per_sec\": %.1f, ", scenario, num_stands, unit, ops, seconds, unit, seconds > 0 ? ops / seconds : 0.0);
+	if (cpu_start >= 0 && cpu_end >= 0)
+	{
+		printf("\"wm_cpu_ms\": %.0f}\n", cpu_end - cpu_start);
+	}
+	else
+	{
+		printf("\"wm_cpu_ms\": null}\n");
+	}
+	fflush(stdout);
+}
+
+static int setup_managed(void)
+{
+	map_all();
+	XMapWindow(dsply, barrier);
+	return wait_for_count(&mapped_count, num_stands) && wait_for_barrier();
+}
+
+static int run_map(void)
+{
+	unsigned long long start;
+	char label[64];
+	int *order;
+	double cpu;
+	int i, j, t;
+
+	order = malloc(num_stands * sizeof *order);
+	if (order == NULL)
+	{
+		fprintf(stderr, "stress: out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < num_stands; i++)
+	{
+		order[i] = (strcmp(opt_closeorder, "reverse") == 0) ? num_stands - 1 - i : i;
+	}
+	if (strcmp(opt_closeorder, "shuffle") == 0)
+	{
+		for (i = num_stands - 1; i > 0; i--)
+		{
+			j = rand() % (i + 1);
+			t = order[i];
+			order[i] = order[j];
+			order[j] = t;
+		}
+	}
+
+	cpu = wm_cpu_ms(opt_wm);
+	start = now_ns();
+	map_all();
+	if (!wait_for_count(&mapped_count, num_stands))
+	{
+		return 1;
+	}
+	print_result("map", "maps", num_stands, start, now_ns(), cpu, wm_cpu_ms(opt_wm));
+
+	cpu = wm_cpu_ms(opt_wm);
+	start = now_ns();
+	for (i = 0; i < num_stands; i++)
+	{
+		XWithdrawWindow(dsply, stands[order[i]].w, DefaultScreen(dsply));
+	}
+	free(order);
+	if (!wait_for_count(&framed_count, 0))
+	{
+		return 1;
+	}
+	if (strcmp(opt_closeorder, "forward") == 0)
+	{
+		snprintf(label, sizeof label, "withdraw");
+	}
+	else
+	{
+		snprintf(label, sizeof label, "withdraw_%s", opt_closeorder);
+	}
+	print_result(label, "withdrawals", num_stands, start, now_ns(), cpu, wm_cpu_ms(opt_wm));
+	return 0;
+}
+
+static int run_changes(Bool titles)
+{
+	unsigned long long start;
+	double cpu;
+	int i;
+
+	if (!setup_managed())
+	{
+		return 1;
+	}
+	cpu = wm_cpu_ms(opt_wm);
+	start = now_ns();
+	for (i = 0; i < opt_count; i++)
+	{
+		if (titles)
+		{
+			retitle(&stands[i % num_stands]);
+		}
+		else
+		{
+			resize(&stands[i % num_stands]);
+		}
+		if (i % 256 == 0)
+		{
+			pump(0); // don't let our own events pile up
+		}
+	}
+	if (!wait_for_barrier())
+	{
+		return 1;
+	}
+	print_result(titles ? "title" : "configure", titles ? "title_updates" : "configures", opt_count, start, now_ns(), cpu, wm_cpu_ms(opt_wm));
+	return 0;
+}
+
+static int run_iconify(void)
+{
+	unsigned long long start;
+	double cpu;
+	int i;
+
+	if (!setup_managed())
+	{
+		return 1;
+	}
+	cpu = wm_cpu_ms(opt_wm);
+	start = now_ns();
+	for (i = 0; i < num_stands; i++)
+	{
+		iconify(&stands[i]);
+	}
+	if (!wait_for_count(&mapped_count, 0))
+	{
+		return 1;
+	}
+	print_result("iconify", "iconifies", num_stands, start, now_ns(), cpu, wm_cpu_ms(opt_wm));
+
+	cpu = wm_cpu_ms(opt_wm);
+	start = now_ns();
+	map_all();
+	if (!wait_for_count(&mapped_count, num_stands))
+	{
+		return 1;
+	}
+	print_result("deiconify", "deiconifies", num_stands, start, now_ns(), cpu, wm_cpu_ms(opt_wm));
+	return 0;
+}
+
+static int run_churn(void)
+{
+	unsigned long long start, end, now, next[4], interval[4];
+	double rates[4] = { opt_maprate, opt_titlerate, opt_configrate, opt_iconifyrate };
+	unsigned long done[4] = { 0, 0, 0, 0 };
+	double cpu, seconds;
+	Stand *s;
+	int i, which;
+
+	if (!setup_managed())
+	{
+		return 1;
+	}
+	cpu = wm_cpu_ms(opt_wm);
+	start = now_ns();
+	end = start + opt_duration * 1000000000ULL;
+	for (i = 0; i < 4; i++)
+	{
+		interval[i] = (rates[i] > 0) ? (unsigned long long)(1e9 / rates[i]) : 0;
+		next[i] = start;
+	}
+	for (;;)
+	{
+		which = -1;
+		for (i = 0; i < 4; i++)
+		{
+			if (interval[i] != 0 && (which < 0 || next[i] < next[which]))
+			{
+				which = i;
+			}
+		}
+		if (which < 0 || next[which] >= end)
+		{
+			break;
+		}
+		now = now_ns();
+		if (next[which] > now)
+		{
+			XFlush(dsply);
+			pump(next[which] - now);
+			continue;
+		}
+		s = &stands[rand() % num_stands];
+		switch (which)
+		{
+			case 0: // map or withdraw
+				if (s->framed)
+				{
+					XWithdrawWindow(dsply, s->w, DefaultScreen(dsply));
+				}
+				else
+				{
+					XMapWindow(dsply, s->w);
+				}
+				break;
+			case 1:
+				retitle(s);
+				break;
+			case 2:
+				resize(s);
+				break;
+			case 3:
+				if (s->mapped)
+				{
+					iconify(s);
+				}
+				else
+				{
+					XMapWindow(dsply, s->w);
+				}
+				break;
+		}
+		done[which]++;
+		next[which] += interval[which];
+		pump(0);
+	}
+	if (!wait_for_barrier())
+	{
+		return 1;
+	}
+	now = now_ns();
+	seconds = (now - start) / 1e9;
+	printf("{\"scenario\": \"churn\", \"windows\": %d, \"seconds\": %.3f, \"maps_per_sec\": %.1f, \"title_updates_per_sec\": %.1f, \"configures_per_sec\": %.1f, \"iconifies_per_sec\": %.1f, \"catch_up_ms\": %.1f, ", num_stands, seconds, done[0] / seconds, done[1] / seconds, done[2] / seconds, done[3] / seconds, (now - end) / 1e6);
+	if (cpu >= 0)
+	{
+		printf("\"wm_cpu_ms\": %.0f}\n", wm_cpu_ms(opt_wm) - cpu);
+	}
+	else
+	{
+		printf("\"wm_cpu_ms\": null}\n");
+	}
+	return 0;
+}
+
+#ifdef XTEST
+
+static void sleep_ns(unsigned long long ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000ULL;
+	ts.tv_nsec = ns % 1000000000ULL;
+	nanosleep(&ts, NULL);
+}
+
+/* Move the windows into a grid before they're mapped, so that every
+ * one of them can be clicked on. */
+
+static Bool grid_stands(void)
+{
+	int dw = DisplayWidth(dsply, DefaultScreen(dsply)), dh = DisplayHeight(dsply, DefaultScreen(dsply));
+	int cols = (dw - 20) / GRID_WIDTH, rows = (dh - GRID_TOP) / GRID_HEIGHT, i;
+
+	if (num_stands > cols * rows)
+	{
+		fprintf(stderr, "stress: only %d windows fit on the screen for the %s scenario\n", cols * rows, opt_scenario);
+		return False;
+	}
+	for (i = 0; i < num_stands; i++)
+	{
+		XMoveWindow(dsply, stands[i].w, 20 + (i % cols) * GRID_WIDTH, GRID_TOP + (i / cols) * GRID_HEIGHT);
+	}
+	return True;
+}
+
+/* Where the window is on the root, and where its frame's titlebar is
+ * (between the top of the frame and the top of the window). */
+
+static Bool find_stand(Stand *s, int *x, int *y, int *bar_y)
+{
+	Window dummy, parent, *children;
+	unsigned int nchildren, udummy;
+	int frame_x, frame_y;
+
+	if (!XQueryTree(dsply, s->w, &dummy, &parent, &children, &nchildren))
+	{
+		return False;
+	}
+	if (children != NULL)
+	{
+		XFree(children);
+	}
+	if (parent == root || !XGetGeometry(dsply, parent, &dummy, &frame_x, &frame_y, &udummy, &udummy, &udummy, &udummy))
+	{
+		return False;
+	}
+	XTranslateCoordinates(dsply, s->w, root, 0, 0, x, y, &dummy);
+	*bar_y = (frame_y + *y) / 2;
+	return True;
+}
+
+static int run_drag(void)
+{
+	unsigned long long start, deadline;
+	double cpu;
+	int i, j, x, y, bar_y, d;
+
+	if (!grid_stands() || !setup_managed())
+	{
+		return 1;
+	}
+	XSelectInput(dsply, root, SubstructureNotifyMask);
+	cpu = wm_cpu_ms(opt_wm);
+	start = now_ns();
+	for (i = 0; i < opt_count; i++)
+	{
+		if (!find_stand(&stands[i % num_stands], &x, &y, &bar_y))
+		{
+			fprintf(stderr, "stress: window %d isn't framed\n", i % num_stands);
+			return 1;
+		}
+		x += 10; // clear of the titlebar's buttons, which are on the right
+		XTestFakeMotionEvent(dsply, -1, x, bar_y, CurrentTime);
+		drag_started = False;
+		XTestFakeButtonEvent(dsply, Button1, True, CurrentTime);
+		// motion before windowlab has grabbed the pointer would be lost
+		XFlush(dsply);
+		deadline = now_ns() + TIMEOUT_NS;
+		while (!drag_started)
+		{
+			if (now_ns() > deadline)
+			{
+				fprintf(stderr, "stress: windowlab didn't start dragging\n");
+				return 1;
+			}
+			pump(100000000ULL);
+		}
+		XSync(dsply, False);
+		// out and back again, so the window ends up where it started
+		for (j = 1; j <= DRAG_MOTIONS; j++)
+		{
+			d = (j <= DRAG_MOTIONS / 2) ? j : DRAG_MOTIONS - j;
+			XTestFakeMotionEvent(dsply, -1, x + d, bar_y + d, CurrentTime);
+			XFlush(dsply);
+			sleep_ns(1000000ULL);
+		}
+		XTestFakeButtonEvent(dsply, Button1, False, CurrentTime);
+		if (!wait_for_barrier())
+		{
+			return 1;
+		}
+	}
+	print_result("drag", "drags", opt_count, start, now_ns(), cpu, wm_cpu_ms(opt_wm));
+	return 0;
+}
+
+static int run_focus(void)
+{
+	unsigned long long start;
+	Window focus;
+	double cpu;
+	int i, x, y, bar_y, revert;
+
+	if (!grid_stands() || !setup_managed())
+	{
+		return 1;
+	}
+	cpu = wm_cpu_ms(opt_wm);
+	start = now_ns();
+	for (i = 0; i < opt_count; i++)
+	{
+		if (!find_stand(&stands[i % num_stands], &x, &y, &bar_y))
+		{
+			fprintf(stderr, "stress: window %d isn't framed\n", i % num_stands);
+			return 1;
+		}
+		// in the window itself, so the click isn't taken as the start of a drag
+		XTestFakeMotionEvent(dsply, -1, x + 20, y + 20, CurrentTime);
+		XTestFakeButtonEvent(dsply, Button1, True, CurrentTime);
+		XTestFakeButtonEvent(dsply, Button1, False, CurrentTime);
+		if (i % 16 == 0)
+		{
+			pump(0);
+		}
+	}
+	if (!wait_for_barrier())
+	{
+		return 1;
+	}
+	XGetInputFocus(dsply, &focus, &revert);
+	if (focus != stands[(opt_count - 1) % num_stands].w)
+	{
+		fprintf(stderr, "stress: the last window clicked on doesn't have the focus\n");
+		return 1;
+	}
+	print_result("focus", "clicks", opt_count, start, now_ns(), cpu, wm_cpu_ms(opt_wm));
+	return 0;
+}
+
+#else
+
+static int run_drag(void)
+{
+	fprintf(stderr, "stress: the drag scenario needs XTest (build with -DXTEST)\n");
+	return 2;
+}
+
+static int run_focus(void)
+{
+	fprintf(stderr, "stress: the focus scenario needs XTest (build with -DXTEST)\n");
+	return 2;
+}
+
+#endif
+
+static int run_startup(void)
+{
+	unsigned long long start;
+	struct rusage usage;
+	double cpu;
+	pid_t pid;
+	int status;
+
+	if (opt_exec == NULL)
+	{
+		fprintf(stderr, "stress: the startup scenario needs -exec\n");
+		return 2;
+	}
+	// with no window manager running these are mapped straight away
+	map_all();
+	if (!wait_for_count(&mapped_count, num_stands))
+	{
+		return 1;
+	}
+	start = now_ns();
+	pid = fork();
+	if (pid == 0)
+	{
+		execl("/bin/sh", "sh", "-c", opt_exec, (char *)NULL);
+		_exit(127);
+	}
+	else if (pid < 0)
+	{
+		fprintf(stderr, "stress: can't start '%s'\n", opt_exec);
+		return 1;
+	}
+	if (!wait_for_count(&framed_count, num_stands))
+	{
+		kill(pid, SIGTERM);
+		return 1;
+	}
+	// don't count the time it takes to be told to quit
+	cpu = wm_cpu_ms(pid);
+	print_result("startup", "windows_adopted", num_stands, start, now_ns(), 0, cpu);
+	kill(pid, SIGTERM);
+	if (waitpid(pid, &status, 0) != pid)
+	{
+		return 1;
+	}
+	if (cpu < 0 && getrusage(RUSAGE_CHILDREN, &usage) == 0)
+	{
+		fprintf(stderr, "stress: window manager used %.0fms of CPU, including quitting\n", (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3);
+	}
+	// windowlab -budget exits with 3 if it went over
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 3)
+	{
+		fprintf(stderr, "stress: window manager went over its request budgets\n");
+		return 1;
+	}
+	return 0;
+}
+
+static int compare_us(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+	return (x > y) - (x < y);
+}
+
+/* The probe is some other client going about its business while the
+ * window manager is kept busy: on a connection of its own, it makes a
+ * round trip every millisecond and times it. Anything that holds up
+ * the server, like a grab, holds it up too. It runs in a child process
+ * so its timing doesn't depend on how quickly we handle our events,
+ * stops when ctl is closed, and writes "<round trips> <p50> <p99> <max>"
+ * (in microseconds) to result. */
+
+static void run_probe(int ctl, int result)
+{
+	Display *probe = XOpenDisplay(opt_display);
+	unsigned int *samples = malloc(MAX_PROBES * sizeof *samples);
+	unsigned long long t;
+	struct pollfd pfd;
+	FILE *out;
+	int n = 0;
+
+	if (probe == NULL || samples == NULL)
+	{
+		fprintf(stderr, "stress: can't start the probe\n");
+		_exit(1);
+	}
+	pfd.fd = ctl;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 1) == 0 && n < MAX_PROBES)
+	{
+		t = now_ns();
+		XSync(probe, False);
+		samples[n++] = (now_ns() - t) / 1000;
+	}
+	qsort(samples, n, sizeof *samples, compare_us);
+	out = fdopen(result, "w");
+	if (n > 0)
+	{
+		fprintf(out, "%d %u %u %u\n", n, samples[n / 2], samples[(int)(n * 0.99)], samples[n - 1]);
+	}
+	else
+	{
+		fprintf(out, "0 0 0 0\n");
+	}
+	fclose(out);
+	_exit(0);
+}
+
+static int run_latency(void)
+{
+	unsigned long long start, end;
+	unsigned int p50 = 0, p99 = 0, max = 0;
+	int ctl[2], result[2], probes = 0, cycles = 0, i, status;
+	double cpu, cpu_end;
+	pid_t pid;
+	FILE *in;
+
+	if (pipe(ctl) < 0 || pipe(result) < 0)
+	{
+		fprintf(stderr, "stress: pipe: %s\n", strerror(errno));
+		return 1;
+	}
+	pid = fork();
+	if (pid == 0)
+	{
+		close(ctl[1]);
+		close(result[0]);
+		run_probe(ctl[0], result[1]);
+	}
+	else if (pid < 0)
+	{
+		fprintf(stderr, "stress: fork: %s\n", strerror(errno));
+		return 1;
+	}
+	close(ctl[0]);
+	close(result[1]);
+
+	cpu = wm_cpu_ms(opt_wm);
+	start = now_ns();
+	end = start + opt_duration * 1000000000ULL;
+	while (now_ns() < end)
+	{
+		map_all();
+		if (!wait_for_count(&framed_count, num_stands))
+		{
+			break;
+		}
+		for (i = 0; i < num_stands; i++)
+		{
+			XWithdrawWindow(dsply, stands[i].w, DefaultScreen(dsply));
+		}
+		if (!wait_for_count(&framed_count, 0))
+		{
+			break;
+		}
+		cycles++;
+	}
+	end = now_ns();
+	cpu_end = wm_cpu_ms(opt_wm);
+
+	close(ctl[1]);
+	in = fdopen(result[0], "r");
+	if (in == NULL || fscanf(in, "%d %u %u %u", &probes, &p50, &p99, &max) != 4)
+	{
+		fprintf(stderr, "stress: no results from the probe\n");
+	}
+	if (in != NULL)
+	{
+		fclose(in);
+	}
+	waitpid(pid, &status, 0);
+
+	printf("{\"scenario\": \"latency\", \"windows\": %d, \"cycles\": %d, \"seconds\": %.3f, \"probe_round_trips\": %d, \"probe_p50_us\": %u, \"probe_p99_us\": %u, \"probe_max_us\": %u, ", num_stands, cycles, (end - start) / 1e9, probes, p50, p99, max);
+	if (cpu >= 0 && cpu_end >= 0)
+	{
+		printf("\"wm_cpu_ms\": %.0f}\n", cpu_end - cpu);
+	}
+	else
+	{
+		printf("\"wm_cpu_ms\": null}\n");
+	}
+	return cycles > 0 && probes > 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	int i;
+
+#define OPT_STR(name, variable) \
+	if (strcmp(argv[i], name) == 0 && i + 1 < argc) \
+	{ \
+		variable = argv[++i]; \
+		continue; \
+	}
+#define OPT_NUM(name, variable, conv) \
+	if (strcmp(argv[i], name) == 0 && i + 1 < argc) \
+	{ \
+		variable = conv(argv[++i]); \
+		continue; \
+	}
+
+	for (i = 1; i < argc; i++)
+	{
+		OPT_STR("-display", opt_display)
+		OPT_STR("-scenario", opt_scenario)
+		OPT_STR("-exec", opt_exec)
+		OPT_STR("-closeorder", opt_closeorder)
+		OPT_NUM("-windows", num_stands, atoi)
+		OPT_NUM("-count", opt_count, atoi)
+		OPT_NUM("-duration", opt_duration, atoi)
+		OPT_NUM("-titlelen", opt_titlelen, atoi)
+		OPT_NUM("-maprate", opt_maprate, atof)
+		OPT_NUM("-titlerate", opt_titlerate, atof)
+		OPT_NUM("-configrate", opt_configrate, atof)
+		OPT_NUM("-iconifyrate", opt_iconifyrate, atof)
+		OPT_NUM("-wm", opt_wm, atoi)
+		usage();
+	}
+	if (num_stands < 1)
+	{
+		usage();
+	}
+
+	dsply = XOpenDisplay(opt_display);
+	if (dsply == NULL)
+	{
+		fprintf(stderr, "stress: can't open display %s\n", XDisplayName(opt_display));
+		return 1;
+	}
+	root = DefaultRootWindow(dsply);
+	wm_change_state = XInternAtom(dsply, "WM_CHANGE_STATE", False);
+	stand_context = XUniqueContext();
+	srand(1); // the same windows in the same places every run
+	make_stands();
+	barrier = make_window(0, 20);
+	XStoreName(dsply, barrier, "stress barrier");
+
+	if (strcmp(opt_scenario, "map") == 0)
+	{
+		return run_map();
+	}
+	else if (strcmp(opt_scenario, "title") == 0)
+	{
+		return run_changes(True);
+	}
+	else if (strcmp(opt_scenario, "configure") == 0)
+	{
+		return run_changes(False);
+	}
+	else if (strcmp(opt_scenario, "iconify") == 0)
+	{
+		return run_iconify();
+	}
+	else if (strcmp(opt_scenario, "churn") == 0)
+	{
+		return run_churn();
+	}
+	else if (strcmp(opt_scenario, "startup") == 0)
+	{
+		return run_startup();
+	}
+	else if (strcmp(opt_scenario, "latency") == 0)
+	{
+		return run_latency();
+	}
+	else if (strcmp(opt_scenario, "drag") == 0)
+	{
+		return run_drag();
+	}
+	else if (strcmp(opt_scenario, "focus") == 0)
+	{
+		return run_focus();
+	}
+	usage();
+	return 2;
+}
@@ -42,6 +42,9 @@
 #ifdef XFT
 #include <X11/Xft/Xft.h>
 #endif
+#ifdef XCB
+#include <X11/Xlib-xcb.h>
+#endif
 
 #ifdef MWM_HINTS
 // These definitions are taken from LessTif 0.95.0's MwmUtil.h.
@@ -111,6 +114,12 @@ typedef struct PropMwmHints
 // max time between clicks in double click
 #define DEF_DBLCLKTIME 400
 
+// while dragging a window, how many times a second to move its frame
+// (0 moves it on every motion event) and how many times a second to
+// tell the client where it is (0 only tells it when the drag ends)
+#define DEF_MOVERATE 60
+#define DEF_CONFIGRATE 4
+
 // a few useful masks made up out of X's basic ones. `ChildMask' is a silly name, but oh well.
 #define ChildMask (SubstructureRedirectMask|SubstructureNotifyMask)
 #define ButtonMask (ButtonPressMask|ButtonReleaseMask)
@@ -171,6 +180,41 @@ typedef struct PropMwmHints
 #define WITHDRAW 0
 #define REMAP 1
 
+// states for draw_buttons and friends
+#define BUTTON_ACTIVE 0
+#define BUTTON_INACTIVE 1
+#define BUTTON_DEPRESSED 2
+
+// what needs repainting in Client.dirty (and redoing in Client.deferred)
+#define DIRTY_FRAME (1 << 0)
+#define DIRTY_TASKBUTTON (1 << 1)
+#define DIRTY_SHAPE (1 << 2)
+
+/* Flood control: a client can have FLOOD_BURST of its events handled
+ * in a row, and FLOOD_RATE a second after that, before its cosmetic
+ * work is put off for FLOOD_DELAY nanoseconds and done in one go. */
+#define FLOOD_RATE 100
+#define FLOOD_BURST 200
+#define FLOOD_DELAY 100000000ULL
+
+// handlers with their own latency histogram in stats.c
+#define STAT_MANAGE 0
+#define STAT_UNMANAGE 1
+#define STAT_PAINT 2
+#define STAT_MOVE 3
+#define STAT_RESIZE 4
+#define STAT_TASKBAR 5
+#define STAT_FOCUS 6
+#define STAT_MAP_LATENCY 7 // from MapRequest until the frame is mapped
+#define NUM_HANDLERS 8
+#define NUM_BUCKETS 40
+
+// time a call for one of the handlers above, and count the requests it makes
+#define TIMED(which, call) do { Mark timed_mark; start_mark(&timed_mark); call; record_handler(which, &timed_mark); } while (0)
+
+// wrap calls that wait for a reply from the server, so they're counted
+#define ROUNDTRIP(call) (count_roundtrip(__FILE__), (call))
+
 // stuff for the menu file
 #define MAX_MENUITEMS 24
 #define MAX_MENUITEMS_SIZE (sizeof(MenuItem) * MAX_MENUITEMS)
@@ -178,6 +222,30 @@ typedef struct PropMwmHints
 #define NO_MENU_LABEL "xterm"
 #define NO_MENU_COMMAND "xterm"
 
+/* How much of a client's name fits in avail pixels: the first len
+ * characters, which are width pixels wide, followed by an ellipsis if
+ * the name had to be cut short. avail is FIT_UNKNOWN until it's worked
+ * out; the space can itself be negative, so that's one it never is. */
+
+#define FIT_UNKNOWN INT_MIN
+
+typedef struct TitleFit
+{
+	int avail;
+	int len, width;
+	Bool ellipsis;
+} TitleFit;
+
+/* What a client has been sending us (see charge_client): the events,
+ * how many came in once it had run out of tokens, and how much
+ * cosmetic work was put off because of that, or merged with work
+ * that had already been put off. */
+
+typedef struct FloodStats
+{
+	unsigned long events, over, deferred, merged;
+} FloodStats;
+
 /* This structure keeps track of top-level windows (hereinafter
  * 'clients'). The clients we know about (i.e. all that don't set
  * override-redirect) are kept track of in linked list starting at the
@@ -196,7 +264,7 @@ typedef struct PropMwmHints
 
 typedef struct Client
 {
-	struct Client *next;
+	struct Client *next, *prev;
 	char *name;
 	XSizeHints *size;
 	Window window, frame, trans;
@@ -206,9 +274,21 @@ typedef struct Client
 	int ignore_unmap;
 	unsigned int hidden;
 	unsigned int was_hidden;
-	unsigned int focus_order;
+	struct Client *focus_prev, *focus_next; // see check_focus
+	unsigned int dirty;
+	unsigned int taskbar_slot;
+	int name_len, name_width;
+	Bool name_stale;
+	TitleFit bar_fit, button_fit;
+	unsigned long long map_requested;
+	unsigned int tokens;
+	unsigned long long tokens_at;
+	unsigned int deferred;
+	struct Timer *flood_timer;
+	FloodStats flood;
 #ifdef SHAPE
-	Bool has_been_shaped;
+	Bool shaped, has_been_shaped;
+	int shape_width, shape_height;
 #endif
 #ifdef MWM_HINTS
 	Bool has_title, has_border;
@@ -224,6 +304,56 @@ typedef struct Rect
 	int width, height;
 } Rect;
 
+typedef struct MotionStats
+{
+	unsigned long received, handled;
+} MotionStats;
+
+typedef struct CoalesceStats
+{
+	unsigned long received;
+	unsigned long configures, exposes, properties, shapes; // merged away
+} CoalesceStats;
+
+typedef struct PaintStats
+{
+	unsigned long frame_requests, frame_paints;
+	unsigned long taskbutton_requests, taskbutton_paints;
+	unsigned long taskbar_requests, taskbar_paints;
+} PaintStats;
+
+typedef struct Histogram
+{
+	unsigned long count;
+	unsigned long long total_ns, max_ns;
+	unsigned long buckets[NUM_BUCKETS];
+	unsigned long long requests, roundtrips;
+} Histogram;
+
+/* Where a timed piece of work started: the time, the next request's
+ * sequence number and the round trips so far, and how much of that
+ * traffic had been put down to handlers that had finished (so that a
+ * handler's budget leaves out the ones it calls). units is how much
+ * work it turned out to be, for handlers whose budget scales with it. */
+
+typedef struct Mark
+{
+	unsigned long long ns;
+	unsigned long requests, roundtrips;
+	unsigned long claimed_requests, claimed_roundtrips;
+	unsigned long units;
+} Mark;
+
+/* A timer set with add_timer; see loop.c. */
+
+typedef struct Timer
+{
+	struct Timer *next;
+	unsigned long long when, interval;
+	void (*fire)(void *);
+	void *data;
+} Timer;
+
 typedef struct MenuItem
 {
 	char *command, *label;
@@ -233,12 +363,23 @@ typedef struct MenuItem
 
 // Below here are (mainly generated with cproto) declarations and prototypes for each file.
 
+// loop.c
+extern void init_loop(void);
+extern void watch_fd(int, void (*)(int, void *), void *);
+extern void unwatch_fd(int);
+extern Timer *add_timer(unsigned long long, unsigned long long, void (*)(void *), void *);
+extern void cancel_timer(Timer *);
+extern int next_xevent(XEvent *);
+
 // main.c
 extern Display *dsply;
+#ifdef XCB
+extern xcb_connection_t *xconn;
+#endif
 extern Window root;
 extern int screen;
-extern Client *head_client, *focused_client, *topmost_client, *fullscreen_client;
-extern unsigned int in_taskbar, showing_taskbar, focus_count;
+extern Client *head_client, *tail_client, *focused_client, *topmost_client, *fullscreen_client;
+extern unsigned int in_taskbar, showing_taskbar;
 extern Rect fs_prevdims;
 extern XFontStruct *font;
 #ifdef XFT
@@ -253,33 +394,62 @@ extern Atom wm_state, wm_change_state, wm_protos, wm_delete, wm_cmapwins;
 extern Atom mwm_hints;
 #endif
 extern char *opt_font, *opt_border, *opt_text, *opt_active, *opt_inactive, *opt_menu, *opt_selected, *opt_empty;
+extern char *opt_record;
+extern int opt_moverate, opt_configrate, opt_budget;
 #ifdef SHAPE
 extern int shape, shape_event;
 #endif
 extern unsigned int numlockmask;
 
 // events.c
+extern CoalesceStats coalesce_stats;
 extern void do_event_loop(void);
 
 // client.c
+extern void index_client(Client *);
+extern void unindex_client(Client *);
 extern Client *find_client(Window, int);
 extern void set_wm_state(Client *, int);
-extern long get_wm_state(Client *);
+extern long get_wm_state(Window);
 extern void send_config(Client *);
 extern void remove_client(Client *, int);
+extern PaintStats paint_stats;
+extern void invalidate_title(Client *);
+extern long title_fetch_length(int);
+extern char *fetch_title(Window, int);
+extern void update_title(Client *);
+extern TitleFit *fit_title(Client *, TitleFit *, int);
+#ifdef XFT
+extern void draw_title(Client *, TitleFit *, XftDraw *, int);
+#else
+extern void draw_title(Client *, TitleFit *, Drawable, int);
+#endif
 extern void redraw(Client *);
+extern void schedule_redraw(Client *);
+extern void schedule_taskbutton_redraw(Client *);
+extern void schedule_taskbar_redraw(void);
+extern void flush_redraws(void);
+extern void charge_client(Client *);
+extern void charge_done(void);
+extern Bool defer_work(Client *, unsigned int);
 extern void gravitate(Client *, int);
 #ifdef SHAPE
+extern void query_shape(Client *);
+extern void shape_changed(Client *, XShapeEvent *);
 extern void set_shape(Client *);
 #endif
 extern void check_focus(Client *);
 extern Client *get_prev_focused(void);
-extern void draw_hide_button(Client *, GC *, GC *);
-extern void draw_toggledepth_button(Client *, GC *, GC *);
-extern void draw_close_button(Client *, GC *, GC *);
+extern void forget_focus(Client *);
+extern void make_button_pixmaps(void);
+extern void draw_buttons(Client *, int);
+extern void draw_hide_button(Client *, int);
+extern void draw_toggledepth_button(Client *, int);
+extern void draw_close_button(Client *, int);
 
 // new.c
 extern void make_new_client(Window);
+extern void adopt_windows(Window *, unsigned int);
 
 // manage.c
 extern void move(Client *);
@@ -289,16 +459,28 @@ extern void hide(Client *);
 extern void unhide(Client *);
 extern void toggle_fullscreen(Client *);
 extern void send_wm_delete(Client *);
-extern void write_titletext(Client *, Window);
+extern void write_titletext(Client *, Window, int);
+
+// errors.c
+extern int handle_xerror(Display *, XErrorEvent *);
+extern void handle_queued_errors(void);
+extern void client_removed(Client *);
+extern void requests_for(Window);
+extern void requests_done(void);
+extern void ignore_errors(void);
+extern void heed_errors(void);
 
 // misc.c
+extern MotionStats motion_stats;
 extern void err(const char *, ...);
 extern void fork_exec(char *);
-extern void sig_handler(int);
-extern int handle_xerror(Display *, XErrorEvent *);
-extern int ignore_xerror(Display *, XErrorEvent *);
+extern void block_signals(void);
+extern void watch_signals(void);
 extern int send_xmessage(Window, Atom, long);
 extern void get_mouse_position(int *, int *);
+extern unsigned int compress_motion(XEvent *, MotionStats *);
+extern unsigned long long get_time_ns(void);
+extern int wait_for_event(long, XEvent *, int);
 extern void fix_position(Client *);
 extern void refix_position(Client *, XConfigureRequestEvent *);
 extern void copy_dims(Rect *, Rect *);
@@ -308,24 +490,43 @@ extern void dump(Client *);
 extern void dump_clients(void);
 #endif
 
+// record.c
+extern void open_recording(char *);
+extern void log_xevent(XEvent *);
+extern void flush_recording(void);
+extern void close_recording(void);
+
+// stats.c
+extern int over_budget;
+extern void start_mark(Mark *);
+extern void record_event(int, Mark *);
+extern void record_handler(int, Mark *);
+extern void record_latency(int, unsigned long long);
+extern void count_roundtrip(const char *);
+extern void dump_stats(void);
+
 // taskbar.c
 extern Window taskbar;
 #ifdef XFT
 extern XftDraw *tbxftdraw;
 #endif
 extern void make_taskbar(void);
+extern void present_taskbar(int, int);
 extern void cycle_previous(void);
 extern void cycle_next(void);
 extern void lclick_taskbar(int);
 extern void rclick_taskbar(int);
 extern void rclick_root(void);
 extern void redraw_taskbar(void);
+extern void redraw_taskbutton(Client *);
+extern void invalidate_taskbar_layout(void);
 extern float get_button_width(void);
 
 // menufile.c
-extern int do_menuitems;
 extern MenuItem* menuitems;
 extern unsigned int num_menuitems;
 extern void get_menuitems(void);
 extern void free_menuitems(void);
+extern void reload_menuitems(void);
+extern void watch_menufiles(void);
 #endif /* WINDOWLAB_H */